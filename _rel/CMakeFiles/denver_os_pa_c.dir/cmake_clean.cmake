@@ -0,0 +1,15 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/denver_os_pa_c.dir/main.c.o"
+  "CMakeFiles/denver_os_pa_c.dir/main.c.o.d"
+  "CMakeFiles/denver_os_pa_c.dir/mem_pool.c.o"
+  "CMakeFiles/denver_os_pa_c.dir/mem_pool.c.o.d"
+  "CMakeFiles/denver_os_pa_c.dir/test_suite.c.o"
+  "CMakeFiles/denver_os_pa_c.dir/test_suite.c.o.d"
+  "denver_os_pa_c"
+  "denver_os_pa_c.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/denver_os_pa_c.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/denver_os_pa_cpp.dir/mem_pool.c.o"
+  "CMakeFiles/denver_os_pa_cpp.dir/mem_pool.c.o.d"
+  "CMakeFiles/denver_os_pa_cpp.dir/test_suite_cpp.cpp.o"
+  "CMakeFiles/denver_os_pa_cpp.dir/test_suite_cpp.cpp.o.d"
+  "denver_os_pa_cpp"
+  "denver_os_pa_cpp.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C CXX)
+  include(CMakeFiles/denver_os_pa_cpp.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
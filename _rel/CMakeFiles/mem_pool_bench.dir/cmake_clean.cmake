@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/mem_pool_bench.dir/mem_pool.c.o"
+  "CMakeFiles/mem_pool_bench.dir/mem_pool.c.o.d"
+  "CMakeFiles/mem_pool_bench.dir/mem_pool_bench.c.o"
+  "CMakeFiles/mem_pool_bench.dir/mem_pool_bench.c.o.d"
+  "mem_pool_bench"
+  "mem_pool_bench.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/mem_pool_bench.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
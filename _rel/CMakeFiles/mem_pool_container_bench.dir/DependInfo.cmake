@@ -0,0 +1,20 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/mem_pool.c" "CMakeFiles/mem_pool_container_bench.dir/mem_pool.c.o" "gcc" "CMakeFiles/mem_pool_container_bench.dir/mem_pool.c.o.d"
+  "/root/repo/mem_pool_container_bench.cpp" "CMakeFiles/mem_pool_container_bench.dir/mem_pool_container_bench.cpp.o" "gcc" "CMakeFiles/mem_pool_container_bench.dir/mem_pool_container_bench.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
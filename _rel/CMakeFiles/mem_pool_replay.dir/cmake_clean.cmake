@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/mem_pool_replay.dir/mem_pool.c.o"
+  "CMakeFiles/mem_pool_replay.dir/mem_pool.c.o.d"
+  "CMakeFiles/mem_pool_replay.dir/mem_pool_replay.c.o"
+  "CMakeFiles/mem_pool_replay.dir/mem_pool_replay.c.o.d"
+  "mem_pool_replay"
+  "mem_pool_replay.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/mem_pool_replay.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,10 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo
+# Build directory: /root/repo/_rel
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(pool_test_suite "/root/repo/_rel/denver_os_pa_c")
+set_tests_properties(pool_test_suite PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;46;add_test;/root/repo/CMakeLists.txt;0;")
+add_test(pool_cpp_test_suite "/root/repo/_rel/denver_os_pa_cpp")
+set_tests_properties(pool_cpp_test_suite PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/CMakeLists.txt;47;add_test;/root/repo/CMakeLists.txt;0;")
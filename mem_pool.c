@@ -2,11 +2,45 @@
  * Created by Ivo Georgiev on 2/9/16.
  */
 
+#ifdef __linux__
+#define _DEFAULT_SOURCE // for madvise()
+#endif
+
+#if defined(MEM_POOL_STATS) || defined(MEM_POOL_TRACE)
+#define _POSIX_C_SOURCE 199309L // for clock_gettime()
+#include <time.h>
+#endif
+
 #include <stdlib.h>
+#include <stddef.h> // for offsetof()
+#include <stdint.h> // for uint64_t
+#include <limits.h> // for UINT_MAX
+#include <string.h> // for memmove(), memset()
 #include <assert.h>
 #include <stdio.h> // for perror()
 
+#ifdef __linux__
+#define MEM_TRIM // gaps go back to the OS with madvise()
+#define MEM_DIRECT_MAP // large allocations get mappings of their own
+#include <sys/mman.h>
+#include <unistd.h> // for sysconf()
+#endif
+
 #include "mem_pool.h"
+#ifdef MEM_POOL_TRACE
+#include "mem_trace.h"
+#endif
+
+#ifdef __GNUC__
+#define MEM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define MEM_ALWAYS_INLINE inline
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MEM_SCAN_X86 // SSE4.2/AVX2 kernels, picked at runtime
+#include <immintrin.h>
+#endif
 
 /*************/
 /*           */
@@ -28,33 +62,231 @@ static const unsigned   MEM_GAP_IX_INIT_CAPACITY        = 40;
 static const float      MEM_GAP_IX_FILL_FACTOR          = 0.75;
 static const unsigned   MEM_GAP_IX_EXPAND_FACTOR        = 2;
 
+static const unsigned   MEM_QUICK_LIST_BINS             = 61; // prime
+
+static const size_t     MEM_GAP_SUMMARY_MIN_REGION      = 4096;
+static const unsigned   MEM_GAP_SUMMARY_MAX_LEAVES      = 4096;
+
+#define MEM_FIT_BIN_CLASSES 512 // 8 per power of 2, 64 bits of map per word
+static const unsigned   MEM_FIT_BIN_SUB_BITS            = 3;
+static const unsigned   MEM_GOOD_FIT_MAX_WASTE          = 12; // percent
+
+static const size_t     MEM_ZERO_STREAM_MIN             = 8 << 20; // well past L2
+
+#define MEM_SLAB_CLASSES 16 // small sizes up to 16 * MEM_SLAB_CLASS_SIZE
+static const size_t     MEM_SLAB_CLASS_SIZE             = 16;
+static const size_t     MEM_SLAB_SIZE                   = 4096; // pool bytes per slab
+static const unsigned   MEM_SLAB_RECORD                 = 2; // used, in a slab record
+
+static const unsigned   MEM_DIRECT_INIT_CAPACITY        = 8;
+static const unsigned   MEM_DIRECT_EXPAND_FACTOR        = 2;
+static const unsigned   MEM_DIRECT_RECORD               = 3; // used, in a direct record
+
+static const size_t     MEM_TAG_ALIGN                   = 16; // of blocks and payloads
+static const size_t     MEM_TAG_OVERHEAD                = sizeof(alloc_t) + sizeof(size_t);
+static const size_t     MEM_TAG_MIN_BLOCK               = 48; // a gap's tags and links
+
+#ifdef MEM_POOL_HARDENED
+static const size_t     MEM_GUARD_SIZE                  = 16; // canary after an allocation
+static const uint64_t   MEM_CANARY                      = 0xCA7CA7CAFEF00D5Aull;
+static const int        MEM_POISON                      = 0xDF; // fills freed memory
+static const size_t     MEM_POISON_MAX                  = 4096; // bytes per deallocation
+#endif
+
+
+/**********/
+/*        */
+/* Macros */
+/*        */
+/**********/
+#ifdef MEM_POOL_STATS
+#define MEM_STATS_ADD(pool_mgr, counter, n) ((pool_mgr)->stats.counter += (n))
+#else
+#define MEM_STATS_ADD(pool_mgr, counter, n) ((void) 0)
+#endif
+
+#ifdef MEM_POOL_TRACE
+#define MEM_TRACE(op, pool, alloc, size, arg) \
+    _mem_trace_record(op, pool, alloc, size, arg)
+#else
+#define MEM_TRACE(op, pool, alloc, size, arg) ((void) 0)
+#endif
+
+#ifdef MEM_POOL_HARDENED
+#define MEM_FAULT(pool_mgr, alloc, fault) \
+    fault_handler(&(pool_mgr)->pool, (alloc), (fault))
+#else
+#define MEM_FAULT(pool_mgr, alloc, fault) ((void) 0)
+#endif
+
+
 
 /*********************/
 /*                   */
 /* Type declarations */
 /*                   */
 /*********************/
+struct _slab;
+
 typedef struct _node {
     alloc_t alloc_record;
     unsigned used;
     unsigned allocated;
+    unsigned ix; // slot in the node heap
+    unsigned short chunk; // the chunk of the node heap it's in
+    unsigned char deferred; // freed, but not yet merged or in the gap index
+#ifdef MEM_POOL_HARDENED
+    unsigned char guarded; // a canary of MEM_GUARD_SIZE bytes follows the allocation
+#endif
     struct _node *next, *prev; // doubly-linked list for gap deletion
+    size_t dirty; // bytes at the start that may not be zero, the rest are
+    // what only a gap, or only an allocation or a deferred node, uses
+    // note: a node is zeroed out (see _init_node()) or leaves the lists
+    //       of the one before it becomes the other
+    union {
+        struct {
+            struct _node *free_next, *free_prev; // the gaps in address order
+            struct _node *bin_next, *bin_prev; // the gaps of a size class (GOOD_FIT)
+        };
+        struct {
+            size_t waste; // bytes of the node after the allocation (GOOD_FIT, canary)
+            struct _slab *slab; // the slab in this allocation, if any
+            struct _node *quick_next; // singly-linked quick list of deferred nodes
+        };
+    };
 } node_t, *node_pt;
 
 
+// the allocation record of a block in a slab, which takes the place of
+// a node for a small allocation
+// note: starts like a node, with used set to MEM_SLAB_RECORD, so that
+// mem_del_alloc() can tell the two apart
+typedef struct _slab_record {
+    alloc_t alloc_record; // size is the slot of the next free block, if free
+    unsigned used;
+    unsigned short ix; // slot in the slab
+    unsigned short allocated;
+} slab_record_t, *slab_record_pt;
+
+
+// a slab of blocks of one size class, in a single allocation of the pool
+// note: the records are the only metadata outside the pool, there is no
+// node or gap index entry per block
+typedef struct _slab {
+    node_pt node; // the allocation the blocks are in
+    struct _slab *next, *prev; // the slabs of the class with free blocks
+#ifdef MEM_POOL_HARDENED
+    struct _slab *pool_next, *pool_prev; // all the slabs of the pool
+#endif
+    unsigned size_class;
+    unsigned num_blocks;
+    unsigned num_free;
+    unsigned free_head; // slot of the first free block
+    slab_record_t records[];
+} slab_t, *slab_pt;
+
+
+// the allocation record of a large allocation in a mapping of its own,
+// outside the pool, which takes the place of a node
+// note: starts like a node, with used set to MEM_DIRECT_RECORD
+typedef struct _direct_record {
+    alloc_t alloc_record;
+    unsigned used;
+    unsigned allocated;
+    unsigned ix; // slot in the pool's direct table
+    size_t map_size; // size rounded up to whole pages
+} direct_record_t, *direct_record_pt;
+
+
+// the node heap grows by whole chunks, so nodes (and the allocation
+// records the user holds) never move
+// the first-fit scan only reads the dense fit_sizes array (hot), which
+// holds a node's size if it's a gap in the gap index and 0 otherwise,
+// and touches the nodes (cold) only for the one it returns
+typedef struct _node_chunk {
+    node_pt nodes;
+    size_t *fit_sizes;
+    unsigned num_nodes;
+} node_chunk_t, *node_chunk_pt;
+
+
 typedef struct _gap {
     size_t size;
     node_pt node;
 } gap_t, *gap_pt;
 
 
+// a segment tree of the largest gap starting in each of equal regions of
+// the pool, for ADDRESS_FIRST_FIT to find the lowest gap that fits by
+// going down the tree instead of along the free list
+typedef struct _gap_summary {
+    size_t *max; // [1] is the root, the leaves are from [num_leaves] on
+    node_pt *first; // the lowest gap starting in each region, if any
+    unsigned num_leaves; // power of 2
+    size_t region_size;
+} gap_summary_t, *gap_summary_pt;
+
+
+// the gaps binned by size class, for GOOD_FIT to take one from the
+// smallest class that is sure to fit, without a search
+// note: classes are 8 per power of 2 (exact below 8), so a size is at
+// most 1/8 above the lowest size of its class
+typedef struct _fit_bins {
+    node_pt *heads; // a list per class, linked by bin_next/bin_prev
+    uint64_t *map; // a bit per class, set if its list is not empty
+    unsigned max_waste; // percent of a size it may be rounded up by
+} fit_bins_t, *fit_bins_pt;
+
+
+// a gap of a boundary-tag pool, at the start of its block
+// note: an allocated block starts with its allocation record instead,
+// whose mem is never NULL and whose size is the one requested, and
+// every block ends in a tag of its size, with the lowest bit set if it's
+// allocated (an allocated block has one more right after the least
+// block of its size, in its padding if it's larger, to be found from
+// the header)
+typedef struct _tag_gap {
+    alloc_t header; // size is the size of the whole block, mem is NULL
+    struct _tag_gap *next, *prev; // the free list
+} tag_gap_t, *tag_gap_pt;
+
+
 typedef struct _pool_mgr {
     pool_t pool;
-    node_pt node_heap;
+    node_chunk_pt node_heap;
+    unsigned num_chunks;
+    node_pt head; // the node of the segment at the top of the pool
+    node_pt free_head; // the gap at the top of the pool, NULL if none
+    node_pt rover; // the gap NEXT_FIT resumes from, NULL for the top
     unsigned total_nodes;
     unsigned used_nodes;
+    unsigned unused_hint; // no unused node in a lower slot
     gap_pt gap_ix;
     unsigned gap_ix_capacity;
+    gap_summary_t summary; // all zero unless ADDRESS_FIRST_FIT
+    fit_bins_t bins; // all zero unless GOOD_FIT
+    node_pt *quick_lists; // deferred nodes binned by exact size
+    unsigned num_quick;
+    unsigned quick_budget; // 0 means deferred coalescing is off
+    slab_pt *slabs; // the slabs with free blocks, a list per size class
+    size_t small_max; // 0 means the small-object tier is off
+    size_t slab_unused; // bytes of the slabs not in a block in use
+    direct_record_pt *direct; // the direct-mapped allocations
+    unsigned num_direct;
+    unsigned direct_capacity;
+    size_t direct_min; // SIZE_MAX means the direct-mapped path is off
+    pool_layout layout;
+    tag_gap_pt tag_free_head; // the gaps of a boundary-tag pool
+    unsigned num_pins; // compaction is held off until 0
+    unsigned store_ix; // slot in the pool store
+#ifdef MEM_POOL_STATS
+    pool_stats_t stats;
+#endif
+#ifdef MEM_POOL_HARDENED
+    unsigned guard_period; // 0 means no canaries
+    unsigned guard_countdown; // allocations until the next canary
+    slab_pt all_slabs; // to tell the pool's slab records from any other
+#endif
 } pool_mgr_t, *pool_mgr_pt;
 
 
@@ -65,8 +297,27 @@ typedef struct _pool_mgr {
 /*                         */
 /***************************/
 static pool_mgr_pt *pool_store = NULL; // an array of pointers, only expand
-static unsigned pool_store_size = 0;
+static unsigned pool_store_size = 0; // slots handed out, only grows
 static unsigned pool_store_capacity = 0;
+static unsigned *pool_store_free = NULL; // stack of slots of closed pools
+static unsigned pool_store_num_free = 0;
+static unsigned pool_store_live = 0; // open pools
+
+// returns the first index in [0, n) with sizes[i] >= min_size, or n
+typedef unsigned (*mem_scan_fn)(const size_t *sizes, unsigned n, size_t min_size);
+
+static mem_scan_fn scan_fit = NULL; // NULL until first used or set
+static scan_kernel scan_fit_kernel = SCAN_AUTO;
+
+#ifdef MEM_POOL_TRACE
+static FILE *trace_file = NULL;
+static unsigned long trace_start_ns = 0;
+#endif
+
+#ifdef MEM_POOL_HARDENED
+static void _mem_report_fault(pool_pt, alloc_pt, mem_fault);
+static mem_fault_fn fault_handler = _mem_report_fault;
+#endif
 
 
 
@@ -87,18 +338,113 @@ static alloc_status
                                 size_t size,
                                 node_pt node);
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_status _mem_rebuild_gap_ix(pool_mgr_pt pool_mgr);
+static alloc_status _mem_reserve_gap_ix(pool_mgr_pt pool_mgr, unsigned num_gaps);
 
 
 // My functions.
-static void _mem_new_node_heap(node_pt*, unsigned int, pool_pt);
-static void _mem_new_pool(pool_pt, unsigned int, alloc_policy);
+static void _mem_new_node_heap(pool_mgr_pt, size_t);
+static alloc_status _mem_new_node_chunk(node_chunk_pt, unsigned, unsigned, unsigned);
+static void _mem_free_node_chunk(node_chunk_pt);
+static size_t *_mem_fit_size(pool_mgr_pt, node_pt);
+static void _mem_new_pool(pool_pt, size_t, alloc_policy);
 static void _mem_new_gap_ix(gap_pt*, node_pt);
 static void _init_node(node_pt);
+static void _mem_release_node(pool_mgr_pt, node_pt);
 static unsigned _all_pool_mgr_freed();
 static void _set_pool_mgr_to_null(pool_mgr_pt);
+static MEM_ALWAYS_INLINE node_pt _find_fit_node(pool_mgr_pt, size_t, alloc_policy);
 static node_pt _find_first_fit_node(pool_mgr_pt, size_t);
 static node_pt _find_best_fit_node(pool_mgr_pt, size_t);
+static node_pt _find_next_fit_node(pool_mgr_pt, size_t);
+static node_pt _find_address_first_fit_node(pool_mgr_pt, size_t);
+static void _mem_link_gap(pool_mgr_pt, node_pt, node_pt);
+static void _mem_unlink_gap(pool_mgr_pt, node_pt);
+static node_pt _mem_find_free_prev(node_pt);
+static alloc_status _mem_new_gap_summary(pool_mgr_pt);
+static unsigned _mem_summary_region(pool_mgr_pt, node_pt);
+static void _mem_summary_raise(pool_mgr_pt, node_pt);
+static void _mem_summary_update(pool_mgr_pt, unsigned);
+static void _mem_summary_rebuild(pool_mgr_pt);
+static node_pt _find_good_fit_node(pool_mgr_pt, size_t);
+static alloc_status _mem_new_fit_bins(pool_mgr_pt);
+static unsigned _mem_size_class(size_t);
+static size_t _mem_round_to_class(size_t);
+static size_t _mem_good_fit_waste(pool_mgr_pt, size_t);
+static void _mem_bin_gap(pool_mgr_pt, node_pt, size_t);
+static void _mem_unbin_gap(pool_mgr_pt, node_pt, size_t);
+static unsigned _mem_lowest_bit(uint64_t);
+static void _mem_merge_dirty(node_pt, node_pt);
+static void _mem_zero(char *, size_t);
+#ifdef MEM_SCAN_X86
+static void _mem_zero_stream(char *, size_t);
+#endif
 static node_pt _find_unused_node(pool_mgr_pt);
+static void _mem_coalesce_gaps(pool_mgr_pt);
+static alloc_status _mem_coalesce_all(pool_mgr_pt);
+static void _mem_push_quick_list(pool_mgr_pt, node_pt);
+static node_pt _mem_pop_quick_list(pool_mgr_pt, size_t);
+static alloc_status _mem_compact(pool_mgr_pt, size_t, size_t *);
+static void _mem_slide_alloc(pool_mgr_pt, node_pt);
+static unsigned _mem_record_kind(alloc_pt);
+static unsigned _mem_del_kind(pool_mgr_pt, alloc_pt);
+static size_t _mem_node_extent(node_pt);
+static void _mem_set_record_allocated(alloc_pt, unsigned);
+static slab_pt _mem_record_slab(slab_record_pt);
+static alloc_pt _mem_new_small_alloc(pool_mgr_pt, size_t);
+static alloc_status _mem_del_small_alloc(pool_mgr_pt, slab_record_pt);
+static slab_pt _mem_new_slab(pool_mgr_pt, unsigned);
+static alloc_status _mem_free_slab(pool_mgr_pt, slab_pt);
+static void _mem_free_empty_slabs(pool_mgr_pt);
+static void _mem_link_slab(pool_mgr_pt, slab_pt);
+static void _mem_unlink_slab(pool_mgr_pt, slab_pt);
+static alloc_pt _mem_new_direct_alloc(pool_mgr_pt, size_t);
+static alloc_status _mem_new_node_metadata(pool_mgr_pt, size_t, alloc_policy);
+static void _mem_new_tag_pool(pool_mgr_pt);
+static char *_mem_tag_end(pool_mgr_pt);
+static size_t _mem_tag_need(size_t);
+static size_t _mem_tag_block_size(alloc_pt);
+static void _mem_tag_block(alloc_pt, size_t, size_t);
+static void _mem_tag_link(pool_mgr_pt, tag_gap_pt);
+static void _mem_tag_unlink(pool_mgr_pt, tag_gap_pt);
+static size_t _mem_tag_largest_gap(pool_mgr_pt, size_t);
+static alloc_pt _mem_new_tagged_alloc(pool_mgr_pt, size_t, alloc_policy);
+static alloc_status _mem_del_tagged_alloc(pool_mgr_pt, alloc_pt);
+static alloc_status _mem_del_tagged_batch(pool_mgr_pt, alloc_pt *, unsigned);
+static alloc_status _mem_del_direct_alloc(pool_mgr_pt, direct_record_pt);
+static alloc_status _mem_validate_tagged(pool_mgr_pt);
+static alloc_status _mem_validate_slab(pool_mgr_pt, node_pt, unsigned *, size_t *, size_t *);
+static alloc_status _mem_validate_summary(pool_mgr_pt);
+static alloc_status _mem_validate_bins(pool_mgr_pt);
+static int _mem_compare_gaps(const void *, const void *);
+static int _mem_find_in_gap_ix(pool_mgr_pt, node_pt);
+static unsigned _mem_scan_fit_scalar(const size_t *, unsigned, size_t);
+#ifdef MEM_SCAN_X86
+static unsigned _mem_scan_fit_sse42(const size_t *, unsigned, size_t);
+static unsigned _mem_scan_fit_avx2(const size_t *, unsigned, size_t);
+#endif
+static void _mem_count_gap(pool_pt, size_t, int);
+static MEM_ALWAYS_INLINE alloc_pt _mem_new_alloc_recorded(pool_pt, size_t, alloc_policy);
+static MEM_ALWAYS_INLINE alloc_pt _mem_new_alloc(pool_pt, size_t, alloc_policy);
+static alloc_status _mem_del_alloc(pool_pt, alloc_pt);
+static alloc_status _mem_pool_close(pool_pt);
+#if defined(MEM_POOL_STATS) || defined(MEM_POOL_TRACE)
+static unsigned long _mem_now_ns();
+#endif
+#ifdef MEM_POOL_STATS
+static void _mem_stats_record(unsigned long *, unsigned long);
+#endif
+#ifdef MEM_POOL_HARDENED
+static unsigned _mem_owns_node(pool_mgr_pt, node_pt);
+static void _mem_arm_guard(node_pt);
+static unsigned _mem_guard_intact(node_pt);
+static void _mem_check_guard(pool_mgr_pt, node_pt);
+static void _mem_poison(char *, size_t);
+#endif
+#ifdef MEM_POOL_TRACE
+static void _mem_trace_record(mem_trace_op, const void *, const void *,
+                              size_t, unsigned);
+#endif
 
 
 /****************************************/
@@ -115,9 +461,21 @@ alloc_status mem_init() {
     // note: holds pointers only, other functions to allocate/deallocate
     pool_store = (pool_mgr_pt*) calloc(
         MEM_POOL_STORE_INIT_CAPACITY, sizeof(pool_mgr_pt));
+    pool_store_free = (unsigned*) calloc(
+        MEM_POOL_STORE_INIT_CAPACITY, sizeof(unsigned));
+    if (!pool_store || !pool_store_free)
+    {
+        free(pool_store);
+        free(pool_store_free);
+        pool_store = NULL;
+        pool_store_free = NULL;
+        return ALLOC_FAIL;
+    }
 
     pool_store_capacity = MEM_POOL_STORE_INIT_CAPACITY;
     pool_store_size = 0;
+    pool_store_num_free = 0;
+    pool_store_live = 0;
     return ALLOC_OK;
 }
 
@@ -129,13 +487,16 @@ alloc_status mem_free() {
     // make sure all pool managers have been deallocated
     if (!_all_pool_mgr_freed()) return ALLOC_FAIL;
 
-    // can free the pool store array
+    // can free the pool store arrays
     free(pool_store);
+    free(pool_store_free);
 
     // update static variables
     pool_store_size = 0;
     pool_store_capacity = 0;
+    pool_store_num_free = 0;
     pool_store = NULL;
+    pool_store_free = NULL;
 
     return ALLOC_OK;
 }
@@ -144,24 +505,28 @@ alloc_status mem_free() {
 // Checks if all pool managers have been deallocated.
 static unsigned _all_pool_mgr_freed()
 {
-    for (int i = 0; i < pool_store_size; ++i)
-    {
-        if (pool_store[i])
-        {
-            return 0; // False.
-        }
-    }
-    return 1; // True.
+    return pool_store_live == 0;
 }
 
 
 pool_pt mem_pool_open(size_t size, alloc_policy policy) {
+    return mem_pool_open_layout(size, policy, LAYOUT_NODE_HEAP);
+}
+
+
+pool_pt mem_pool_open_layout(size_t size, alloc_policy policy, pool_layout layout) {
 
     // make sure there the pool store is allocated
     if (!pool_store) return NULL;
 
-    // expand the pool store, if necessary
-    _mem_resize_pool_store();
+    // boundary tags only go with the policies of a free list walk, and
+    // need room for a gap
+    if (layout == LAYOUT_BOUNDARY_TAG &&
+        ((policy != FIRST_FIT && policy != BEST_FIT) ||
+         size < MEM_TAG_MIN_BLOCK)) return NULL;
+
+    // expand the pool store, if necessary, quit on error
+    if (_mem_resize_pool_store() == ALLOC_FAIL) return NULL;
 
     // allocate a new mem pool mgr
     // check success, on error return null.
@@ -171,49 +536,83 @@ pool_pt mem_pool_open(size_t size, alloc_policy policy) {
     // allocate a new memory pool
     // check success, on error deallocate mgr and return null
     _mem_new_pool(&new_pool_mgr->pool, size, policy);
-    if (!(&new_pool_mgr->pool))
+    if (!new_pool_mgr->pool.mem)
     {
         free(new_pool_mgr);
         return NULL;
     }
 
-    // allocate a new node heap
+    // a boundary-tag pool is a single gap, tagged in place
+    // otherwise allocate the node heap and the rest of the metadata
     // check success, on error deallocate mgr/pool and return null.
-    _mem_new_node_heap(&new_pool_mgr->node_heap, size, &new_pool_mgr->pool);
-    if (!new_pool_mgr->node_heap)
+    new_pool_mgr->layout = layout;
+    if (layout == LAYOUT_BOUNDARY_TAG)
     {
-        free(&new_pool_mgr->pool);
+        _mem_new_tag_pool(new_pool_mgr);
+    }
+    else if (_mem_new_node_metadata(new_pool_mgr, size, policy) == ALLOC_FAIL)
+    {
+        free(new_pool_mgr->pool.mem);
         free(new_pool_mgr);
         return NULL;
     }
+    
+    // link pool mgr to pool store
+    // return the address of the mgr, cast to (pool_pt)
+    new_pool_mgr->direct_min = SIZE_MAX;
+    new_pool_mgr->store_ix = pool_store_num_free ?
+        pool_store_free[--pool_store_num_free] : pool_store_size++;
+    pool_store[new_pool_mgr->store_ix] = new_pool_mgr;
+    pool_store_live++;
+    MEM_TRACE(TRACE_POOL_OPEN, new_pool_mgr, NULL, size,
+              policy | layout << MEM_TRACE_LAYOUT_SHIFT);
+    return (pool_pt) new_pool_mgr;
+}
+
+
+// Allocates the node heap, the gap index, and whatever else the policy
+// uses, for a pool of the given size. On error, frees what it allocated.
+static alloc_status _mem_new_node_metadata(pool_mgr_pt new_pool_mgr,
+                                           size_t size,
+                                           alloc_policy policy)
+{
+    // allocate a new node heap
+    // check success, on error return fail.
+    _mem_new_node_heap(new_pool_mgr, size);
+    if (!new_pool_mgr->node_heap) return ALLOC_FAIL;
 
     // allocate a new gap index
-    // check success, on error deallocate mgr/pool/heap and return null.
-    _mem_new_gap_ix(&new_pool_mgr->gap_ix, new_pool_mgr->node_heap);
+    // check success, on error deallocate heap and return fail.
+    _mem_new_gap_ix(&new_pool_mgr->gap_ix, new_pool_mgr->head);
     if (!new_pool_mgr->gap_ix)
     {
+        _mem_free_node_chunk(&new_pool_mgr->node_heap[0]);
         free(new_pool_mgr->node_heap);
-        free(&new_pool_mgr->pool);
-        free(new_pool_mgr);
-        return NULL;
+        return ALLOC_FAIL;
     }
-    
-    
-    // assign all the pointers and update meta data:
-    //   initialize top node of node heap        **DONE**
-    //   initialize top node of gap index        **DONE**
-    //   initialize pool mgr                    **DONE**
-    //   link pool mgr to pool store            **DONE**
-    // return the address of the mgr, cast to (pool_pt)
+
+    // allocate a gap summary, if the policy uses it, or the size class
+    // bins, if the policy uses them
+    // check success, on error deallocate heap/index and return fail.
+    if ((policy == ADDRESS_FIRST_FIT &&
+         _mem_new_gap_summary(new_pool_mgr) == ALLOC_FAIL) ||
+        (policy == GOOD_FIT && _mem_new_fit_bins(new_pool_mgr) == ALLOC_FAIL))
+    {
+        free(new_pool_mgr->gap_ix);
+        _mem_free_node_chunk(&new_pool_mgr->node_heap[0]);
+        free(new_pool_mgr->node_heap);
+        return ALLOC_FAIL;
+    }
+
+    // initialize the rest of the meta data
     new_pool_mgr->used_nodes = 1;    // One gap when first initialized.
-    new_pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+    new_pool_mgr->unused_hint = 1;
     new_pool_mgr->gap_ix_capacity = MEM_GAP_IX_INIT_CAPACITY;
-    pool_store[pool_store_size++] = new_pool_mgr;
-    return (pool_pt) new_pool_mgr;
+    return ALLOC_OK;
 }
 
 
-void _mem_new_pool(pool_pt pool, unsigned int size, alloc_policy policy)
+void _mem_new_pool(pool_pt pool, size_t size, alloc_policy policy)
 {    
     pool->mem = (char*) calloc(size, sizeof(char));
     pool->policy = policy;
@@ -221,17 +620,81 @@ void _mem_new_pool(pool_pt pool, unsigned int size, alloc_policy policy)
     pool->alloc_size = 0;
     pool->num_allocs = 0;
     pool->num_gaps = 1;
+    pool->largest_gap = size;
+    pool->internal_waste = 0;
+    pool->direct_size = 0;
+    _mem_count_gap(pool, size, 1);
 }
 
 
-void _mem_new_node_heap(node_pt *node_heap, unsigned size, pool_pt pool)
+void _mem_new_node_heap(pool_mgr_pt pool_mgr, size_t size)
 {
-    *node_heap = (node_pt) calloc(MEM_NODE_HEAP_INIT_CAPACITY, sizeof(node_t));
-    node_pt top_node = *node_heap;
+    // a single chunk to start with
+    pool_mgr->node_heap = (node_chunk_pt) calloc(1, sizeof(node_chunk_t));
+    if (!pool_mgr->node_heap) return;
+
+    if (_mem_new_node_chunk(&pool_mgr->node_heap[0],
+                            0, 0, MEM_NODE_HEAP_INIT_CAPACITY) == ALLOC_FAIL)
+    {
+        free(pool_mgr->node_heap);
+        pool_mgr->node_heap = NULL;
+        return;
+    }
+    pool_mgr->num_chunks = 1;
+    pool_mgr->total_nodes = MEM_NODE_HEAP_INIT_CAPACITY;
+
+    // the top node is the whole pool, as a gap (in the gap index)
+    node_pt top_node = &pool_mgr->node_heap[0].nodes[0];
     top_node->alloc_record.size = size;
-    top_node->alloc_record.mem = pool->mem;
+    top_node->alloc_record.mem = pool_mgr->pool.mem;
     top_node->used = 1;
     top_node->allocated = 0;
+    *_mem_fit_size(pool_mgr, top_node) = size;
+    pool_mgr->head = top_node;
+    pool_mgr->free_head = top_node;
+}
+
+
+// Allocates the nodes (and fit sizes) for chunk number chunk_ix of the
+// node heap, with slots from first_ix on.
+static alloc_status _mem_new_node_chunk(node_chunk_pt chunk,
+                                        unsigned chunk_ix,
+                                        unsigned first_ix,
+                                        unsigned num_nodes)
+{
+    chunk->nodes = (node_pt) calloc(num_nodes, sizeof(node_t));
+    chunk->fit_sizes = (size_t*) calloc(num_nodes, sizeof(size_t));
+    if (!chunk->nodes || !chunk->fit_sizes)
+    {
+        _mem_free_node_chunk(chunk);
+        return ALLOC_FAIL;
+    }
+
+    for (unsigned u = 0; u < num_nodes; ++u)
+    {
+        chunk->nodes[u].ix = first_ix + u;
+        chunk->nodes[u].chunk = (unsigned short) chunk_ix;
+    }
+    chunk->num_nodes = num_nodes;
+    return ALLOC_OK;
+}
+
+
+static void _mem_free_node_chunk(node_chunk_pt chunk)
+{
+    free(chunk->nodes);
+    free(chunk->fit_sizes);
+    chunk->nodes = NULL;
+    chunk->fit_sizes = NULL;
+    chunk->num_nodes = 0;
+}
+
+
+// Returns the node's entry in its chunk's fit_sizes.
+static size_t *_mem_fit_size(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node_chunk_pt chunk = &pool_mgr->node_heap[node->chunk];
+    return &chunk->fit_sizes[node - chunk->nodes];
 }
 
 
@@ -245,6 +708,14 @@ void _mem_new_gap_ix(gap_pt *gap_ix, node_pt node)
 
 
 alloc_status mem_pool_close(pool_pt pool) {
+    // recorded whichever way it ends (the handle is only recorded)
+    alloc_status status = _mem_pool_close(pool);
+    MEM_TRACE(TRACE_POOL_CLOSE, pool, NULL, 0, status);
+    return status;
+}
+
+
+static alloc_status _mem_pool_close(pool_pt pool) {
 
     // check if this pool is allocated
     if (!pool) return ALLOC_NOT_FREED;
@@ -252,6 +723,10 @@ alloc_status mem_pool_close(pool_pt pool) {
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
 
+    // give the empty slabs back, then merge any deferred blocks
+    if (pool_manager->slabs) _mem_free_empty_slabs(pool_manager);
+    if (pool_manager->num_quick) _mem_coalesce_all(pool_manager);
+
     // check if pool has only one gap
     if (!pool->num_gaps == 1) return ALLOC_NOT_FREED;
 
@@ -262,6 +737,10 @@ alloc_status mem_pool_close(pool_pt pool) {
     free(pool->mem);
 
     // free node heap
+    for (unsigned u = 0; u < pool_manager->num_chunks; ++u)
+    {
+        _mem_free_node_chunk(&pool_manager->node_heap[u]);
+    }
     free(pool_manager->node_heap);
     pool_manager->node_heap = NULL;
 
@@ -269,10 +748,33 @@ alloc_status mem_pool_close(pool_pt pool) {
     free(pool_manager->gap_ix);
     pool_manager->gap_ix = NULL;
 
+    // free gap summary
+    free(pool_manager->summary.max);
+    free(pool_manager->summary.first);
+    pool_manager->summary.max = NULL;
+    pool_manager->summary.first = NULL;
+
+    // free size class bins
+    free(pool_manager->bins.heads);
+    free(pool_manager->bins.map);
+    pool_manager->bins.heads = NULL;
+    pool_manager->bins.map = NULL;
+
+    // free quick lists
+    free(pool_manager->quick_lists);
+    pool_manager->quick_lists = NULL;
+
+    // free slab lists
+    free(pool_manager->slabs);
+    pool_manager->slabs = NULL;
+
+    // free direct table
+    free(pool_manager->direct);
+    pool_manager->direct = NULL;
+
     // find mgr in pool store and set to null
     _set_pool_mgr_to_null(pool_manager);
 
-    // note: don't decrement pool_store_size, because it only grows
     // free mgr
     free(pool_manager);
 
@@ -280,64 +782,214 @@ alloc_status mem_pool_close(pool_pt pool) {
 }
 
 
+// Clears the mgr's slot in the pool store, for reuse by the next open.
+// note: pool_store_size only grows, closed slots go on the free stack
 static void _set_pool_mgr_to_null(pool_mgr_pt pool_mgr)
 {
+    pool_store[pool_mgr->store_ix] = NULL;
+    pool_store_free[pool_store_num_free++] = pool_mgr->store_ix;
+    pool_store_live--;
+}
+
+
+alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+    return _mem_new_alloc_recorded(pool, size, pool->policy);
+}
+
+
+// The same as mem_new_alloc(), for a pool of the given policy. The policy
+// is a constant in each, so the allocation is compiled for it alone.
+alloc_pt mem_new_alloc_first_fit(pool_pt pool, size_t size) {
+    assert(pool->policy == FIRST_FIT);
+    return _mem_new_alloc_recorded(pool, size, FIRST_FIT);
+}
+
+
+alloc_pt mem_new_alloc_best_fit(pool_pt pool, size_t size) {
+    assert(pool->policy == BEST_FIT);
+    return _mem_new_alloc_recorded(pool, size, BEST_FIT);
+}
+
+
+alloc_pt mem_new_alloc_next_fit(pool_pt pool, size_t size) {
+    assert(pool->policy == NEXT_FIT);
+    return _mem_new_alloc_recorded(pool, size, NEXT_FIT);
+}
+
+
+alloc_pt mem_new_alloc_address_first_fit(pool_pt pool, size_t size) {
+    assert(pool->policy == ADDRESS_FIRST_FIT);
+    return _mem_new_alloc_recorded(pool, size, ADDRESS_FIRST_FIT);
+}
+
+
+alloc_pt mem_new_alloc_good_fit(pool_pt pool, size_t size) {
+    assert(pool->policy == GOOD_FIT);
+    return _mem_new_alloc_recorded(pool, size, GOOD_FIT);
+}
+
 
-    for (int i = 0; i < pool_store_capacity; ++i)
+alloc_pt mem_new_alloc_zeroed(pool_pt pool, size_t size) {
+    alloc_pt alloc = mem_new_alloc(pool, size);
+    if (!alloc) return NULL;
+
+    // a block of a slab is reused as is, it's small enough to clear
+    // (and so is a block of a boundary-tag pool, which is not tracked)
+    // and a direct mapping is new, so the OS has zeroed it
+    unsigned kind = ((pool_mgr_pt) pool)->layout == LAYOUT_BOUNDARY_TAG ?
+        MEM_SLAB_RECORD : _mem_record_kind(alloc);
+    if (kind == MEM_SLAB_RECORD)
     {
-        if (pool_store[i] == pool_mgr)
-        {
-            pool_store[i] = NULL;
-            break;
-        }
+        memset(alloc->mem, 0, alloc->size);
+        MEM_STATS_ADD((pool_mgr_pt) pool, zeroed_bytes, alloc->size);
+        return alloc;
+    }
+    if (kind == MEM_DIRECT_RECORD)
+    {
+        MEM_STATS_ADD((pool_mgr_pt) pool, zero_skipped_bytes, alloc->size);
+        return alloc;
     }
+
+    // only the part of the gap that may have been written to
+    // note: a canary after the allocation is dirty, and stays so
+    node_pt node = (node_pt) alloc;
+    size_t dirty = node->dirty < alloc->size ? node->dirty : alloc->size;
+    _mem_zero(alloc->mem, dirty);
+    MEM_STATS_ADD((pool_mgr_pt) pool, zeroed_bytes, dirty);
+    MEM_STATS_ADD((pool_mgr_pt) pool, zero_skipped_bytes, alloc->size - dirty);
+    node->dirty -= dirty;
+    return alloc;
 }
 
 
-alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
+// Allocates with the given policy, with stats and tracing, if built in.
+static MEM_ALWAYS_INLINE alloc_pt _mem_new_alloc_recorded(pool_pt pool,
+                                                          size_t size,
+                                                          alloc_policy policy) {
+#ifdef MEM_POOL_STATS
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    unsigned long start = _mem_now_ns();
+
+    alloc_pt alloc = _mem_new_alloc(pool, size, policy);
+
+    _mem_stats_record(pool_mgr->stats.alloc_ns_hist, _mem_now_ns() - start);
+    if (!alloc) MEM_STATS_ADD(pool_mgr, failed_allocs, 1);
+#else
+    alloc_pt alloc = _mem_new_alloc(pool, size, policy);
+#endif
+    MEM_TRACE(TRACE_NEW_ALLOC, pool, alloc, size, 0);
+    return alloc;
+}
 
-    // check if any gaps, return null if none
-    if (pool->num_gaps == 0) return NULL;
+
+static MEM_ALWAYS_INLINE alloc_pt _mem_new_alloc(pool_pt pool,
+                                                 size_t size,
+                                                 alloc_policy policy) {
 
     // get mgr from pool by casting the pointer to (pool_mgr_pt)
     pool_mgr_pt pool_manager = (pool_mgr_pt) pool;
 
+    // nothing to allocate: a node of size 0 would leave a gap of size 0
+    // in the heap when it's deallocated
+    if (!size) return NULL;
+
+    // a boundary-tag pool has no node heap
+    if (pool_manager->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        return _mem_new_tagged_alloc(pool_manager, size, policy);
+    }
+
+    // a small size comes from a slab, if the tier is on
+    if (size - 1 < pool_manager->small_max)
+    {
+        return _mem_new_small_alloc(pool_manager, size);
+    }
+
+    // a large size gets a mapping of its own, if the path is on
+    if (size >= pool_manager->direct_min)
+    {
+        return _mem_new_direct_alloc(pool_manager, size);
+    }
+
+    // GOOD_FIT rounds the block up to its class, within the waste limit
+    // note: the node takes the waste too, the allocation only its size
+    size_t requested = size, waste = 0;
+    if (policy == GOOD_FIT)
+    {
+        waste = _mem_good_fit_waste(pool_manager, size);
+        size += waste;
+    }
+
+#ifdef MEM_POOL_HARDENED
+    // every guard_period-th allocation gets a canary after it, which is
+    // in the node (and counted as waste), but not in the allocation
+    unsigned guarded = 0;
+    if (pool_manager->guard_period && --pool_manager->guard_countdown == 0)
+    {
+        pool_manager->guard_countdown = pool_manager->guard_period;
+        guarded = 1;
+        size += MEM_GUARD_SIZE;
+        waste += MEM_GUARD_SIZE;
+    }
+#endif
+
+    // reuse a deferred block of exactly this size, if there is one
+    node_pt node = _mem_pop_quick_list(pool_manager, size);
+    if (node)
+    {
+        pool->num_allocs++;
+        pool->alloc_size += requested;
+        pool->internal_waste += waste;
+        node->alloc_record.size = requested;
+        node->waste = waste;
+#ifdef MEM_POOL_HARDENED
+        if (guarded) _mem_arm_guard(node);
+#endif
+        return (alloc_pt) node;
+    }
+
+    // check if any gaps, return null if none
+    if (pool->num_gaps == 0 && !pool_manager->num_quick) return NULL;
+
     // check used nodes fewer than total nodes, quit on error
     if (pool_manager->used_nodes >= pool_manager->total_nodes) return NULL;
 
     // expand node heap, if necessary, quit on error
-    _mem_resize_node_heap(pool_manager);
+    if (_mem_resize_node_heap(pool_manager) == ALLOC_FAIL) return NULL;
 
-    // get a node for allocation:
-    node_pt node = NULL;
+    // get a node for allocation
+    node = _find_fit_node(pool_manager, size, policy);
 
-    // if FIRST_FIT, then find the first sufficient node in the node heap
-    if (pool->policy == FIRST_FIT)
-    {
-        node = _find_first_fit_node(pool_manager, size);
-    }
-    // if BEST_FIT, then find the first sufficient node in the gap index
-    else if (pool->policy == BEST_FIT)
+    // no gap is large enough, merge the deferred blocks and try again
+    if (node == NULL && pool_manager->num_quick)
     {
-        node = _find_best_fit_node(pool_manager, size);
+        if (_mem_coalesce_all(pool_manager) == ALLOC_FAIL) return NULL;
+        node = _find_fit_node(pool_manager, size, policy);
     }
 
     // check if node found
     if (node == NULL) return NULL;
 
-    // update metadata (num_allocs, alloc_size)
+    // update metadata (num_allocs, alloc_size, internal_waste)
     pool->num_allocs++;
-    pool->alloc_size += size;
+    pool->alloc_size += requested;
+    pool->internal_waste += waste;
 
     // calculate the size of the remaining gap, if any
-    unsigned remaining = node->alloc_record.size - size;
+    size_t remaining = node->alloc_record.size - size;
+    size_t dirty = node->dirty;
 
-    // remove node from gap index
+    // remove node from gap index (and the free list)
+    node_pt free_prev = node->free_prev, free_next = node->free_next;
     _mem_remove_from_gap_ix(pool_manager, size, node);
+    _mem_unlink_gap(pool_manager, node);
 
     // convert gap_node to an allocation node of given size
+    // note: the waste shares room with the free list links, gone by now
     node->allocated = 1;
-    node->alloc_record.size = size;
+    node->alloc_record.size = requested;
+    node->waste = waste;
+    node->dirty = dirty < size ? dirty : size;
 
     // adjust node heap:
     //   if remaining gap, need a new node
@@ -354,6 +1006,7 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
         unused_node->alloc_record.mem = node->alloc_record.mem + size;
         unused_node->allocated = 0;
         unused_node->used = 1;
+        unused_node->dirty = dirty > size ? dirty - size : 0;
 
         // update linked list (new node right after the node for allocation)
         unused_node->prev = node;
@@ -364,119 +1017,1404 @@ alloc_pt mem_new_alloc(pool_pt pool, size_t size) {
         }
         node->next = unused_node;
 
-        // add to gap index
+        // add to gap index (and the free list, in the node's place)
         _mem_add_to_gap_ix(pool_manager, remaining, unused_node);
+        _mem_link_gap(pool_manager, unused_node, free_prev);
 
         // check if successful  ??
 
         pool_manager->used_nodes++;
     }
+
+    // the next NEXT_FIT search starts right after this allocation
+    pool_manager->rover = remaining ? node->next : free_next;
+
+#ifdef MEM_POOL_HARDENED
+    if (guarded) _mem_arm_guard(node);
+#endif
+
     // return allocation record by casting the node to (alloc_pt)
     return (alloc_pt) node;
 }
 
 
+// Finds a gap node with enough size, according to the given policy.
+static MEM_ALWAYS_INLINE node_pt _find_fit_node(pool_mgr_pt pool_mgr,
+                                                size_t size,
+                                                alloc_policy policy)
+{
+    node_pt node = NULL;
+
+    // if FIRST_FIT, then find the first sufficient node in the node heap
+    if (policy == FIRST_FIT)
+    {
+        node = _find_first_fit_node(pool_mgr, size);
+    }
+    // if BEST_FIT, then find the first sufficient node in the gap index
+    else if (policy == BEST_FIT)
+    {
+        node = _find_best_fit_node(pool_mgr, size);
+    }
+    // if NEXT_FIT, then go on through the free list from the rover
+    else if (policy == NEXT_FIT)
+    {
+        node = _find_next_fit_node(pool_mgr, size);
+    }
+    // if ADDRESS_FIRST_FIT, then go through the free list from the top
+    else if (policy == ADDRESS_FIRST_FIT)
+    {
+        node = _find_address_first_fit_node(pool_mgr, size);
+    }
+    // if GOOD_FIT, then take a gap from the size class bins
+    else if (policy == GOOD_FIT)
+    {
+        node = _find_good_fit_node(pool_mgr, size);
+    }
+    return node;
+}
+
+
 // Finds the first node in the node heap with enough size.
 static node_pt _find_first_fit_node(pool_mgr_pt pool_mgr, size_t size)
 {
-    node_pt node = NULL;
-    for (int i = 0; i < pool_mgr->total_nodes; ++i)
+    // note: a fit size of 0 is not a gap, so never a fit
+    size_t min_size = size ? size : 1;
+
+    if (!scan_fit) mem_set_scan_kernel(SCAN_AUTO);
+
+    for (unsigned c = 0; c < pool_mgr->num_chunks; ++c)
     {
-        node = &pool_mgr->node_heap[i];
-        if (node->used && !node->allocated && 
-           node->alloc_record.size >= size)
+        node_chunk_pt chunk = &pool_mgr->node_heap[c];
+        unsigned i = scan_fit(chunk->fit_sizes, chunk->num_nodes, min_size);
+        if (i < chunk->num_nodes)
         {
-            break;
+            return &chunk->nodes[i];
         }
     }
-    return (node->alloc_record.size >= size ? node : NULL);
+    return NULL;
 }
 
 
 // Finds the best fit node for the given size, in the given pool (manager).
 static node_pt _find_best_fit_node(pool_mgr_pt pool_mgr, size_t size)
 {
-    node_pt node = NULL;
+    // the index is sorted by size, so the first sufficient entry
+    // is found with a binary search rather than a scan
     gap_pt gap_index = pool_mgr->gap_ix;
-    for (int i = 0; i < pool_mgr->gap_ix_capacity; ++i)
+    unsigned lo = 0, hi = pool_mgr->pool.num_gaps;
+    while (lo < hi)
     {
-        if (gap_index[i].size >= size)
+        unsigned mid = lo + (hi - lo) / 2;
+        if (gap_index[mid].size < size)
         {
-            node = gap_index[i].node;
-            break;
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
         }
+        MEM_STATS_ADD(pool_mgr, gap_ix_scans, 1);
     }
-    return node;
+    return lo < pool_mgr->pool.num_gaps ? gap_index[lo].node : NULL;
 }
 
 
-static node_pt _find_unused_node(pool_mgr_pt pool_mgr)
+// Finds the first gap with enough size from the rover down to the bottom
+// of the pool, and then from the top of the pool back to the rover.
+static node_pt _find_next_fit_node(pool_mgr_pt pool_mgr, size_t size)
 {
-    node_pt node = NULL;
-    for (int i = 0; i < pool_mgr->total_nodes; ++i)
+    node_pt start = pool_mgr->rover ? pool_mgr->rover : pool_mgr->free_head;
+    node_pt node = start;
+    while (node)
     {
-        if (!pool_mgr->node_heap[i].used)
-        {
-            node = &pool_mgr->node_heap[i];
-            break;
-        }
+        if (node->alloc_record.size >= size) return node;
+
+        node = node->free_next ? node->free_next : pool_mgr->free_head;
+        if (node == start) break;
     }
-    return node;
+    return NULL;
 }
 
 
-alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
-    // get mgr from pool by casting the pointer to (pool_mgr_pt)
-    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+// Finds the gap with enough size that is the lowest in the pool.
+static node_pt _find_address_first_fit_node(pool_mgr_pt pool_mgr, size_t size)
+{
+    gap_summary_pt summary = &pool_mgr->summary;
+    node_pt node = pool_mgr->free_head;
 
-    // get node from alloc by casting the pointer to (node_pt)
-    node_pt node_to_delete = (node_pt) alloc;
+    // go down the summary to the lowest region with a gap that fits,
+    // then along the free list, from the lowest gap in that region
+    if (summary->max)
+    {
+        if (summary->max[1] < size) return NULL;
 
-    // convert to gap node
-    node_to_delete->allocated = 0;
+        unsigned i = 1;
+        while (i < summary->num_leaves)
+        {
+            i = (summary->max[2 * i] >= size) ? 2 * i : 2 * i + 1;
+        }
+        node = summary->first[i - summary->num_leaves];
+    }
+    while (node && node->alloc_record.size < size)
+    {
+        node = node->free_next;
+    }
+    return node;
+}
 
-    // update metadata (num_allocs, alloc_size)
-    pool->num_allocs--;
-    pool->alloc_size -= alloc->size;
 
-    // if the next node in the list is also a gap, merge into node-to-delete
-    if (node_to_delete->next && !node_to_delete->next->allocated)
+// Takes the first gap of the smallest size class that starts at or above
+// the size, where every gap fits. Only if there is none, looks for one
+// that fits in the size's own class.
+static node_pt _find_good_fit_node(pool_mgr_pt pool_mgr, size_t size)
+{
+    fit_bins_pt bins = &pool_mgr->bins;
+    unsigned c = _mem_size_class(_mem_round_to_class(size));
+
+    for (unsigned w = c / 64; w < MEM_FIT_BIN_CLASSES / 64; ++w)
     {
-        // add the size to the node-to-delete
-        alloc->size += node_to_delete->next->alloc_record.size;
+        uint64_t bits = bins->map[w];
+        if (w == c / 64) bits &= ~(uint64_t) 0 << (c % 64);
+        if (bits) return bins->heads[w * 64 + _mem_lowest_bit(bits)];
+    }
 
-        // remove the next node from gap index
-        _mem_remove_from_gap_ix(pool_mgr,
-                                node_to_delete->next->alloc_record.size,
-                                node_to_delete->next);
+    node_pt node = bins->heads[_mem_size_class(size)];
+    while (node && node->alloc_record.size < size)
+    {
+        node = node->bin_next;
+    }
+    return node;
+}
 
-        // update node as unused
-        node_to_delete->next->used = 0;
-        node_to_delete->next->alloc_record.size = 0;
-        node_to_delete->next->alloc_record.mem = NULL;
 
-        // update metadata (used nodes)
-        pool_mgr->used_nodes--;
+// Links a gap into the free list right after free_prev (NULL for the top).
+static void _mem_link_gap(pool_mgr_pt pool_mgr, node_pt node, node_pt free_prev)
+{
+    node->free_prev = free_prev;
+    node->free_next = free_prev ? free_prev->free_next : pool_mgr->free_head;
+    if (node->free_next)
+    {
+        node->free_next->free_prev = node;
+    }
+    if (free_prev)
+    {
+        free_prev->free_next = node;
+    }
+    else
+    {
+        pool_mgr->free_head = node;
+    }
 
-        // update linked list:
-        if (node_to_delete->next->next)
+    // update the gap summary, if any
+    if (pool_mgr->summary.max)
+    {
+        unsigned region = _mem_summary_region(pool_mgr, node);
+        node_pt first = pool_mgr->summary.first[region];
+        if (!first || node->alloc_record.mem < first->alloc_record.mem)
         {
-            node_to_delete->next->next->prev = node_to_delete;
-            node_to_delete->next = node_to_delete->next->next;
+            pool_mgr->summary.first[region] = node;
         }
-        else
+        _mem_summary_raise(pool_mgr, node);
+    }
+}
+
+
+// Unlinks a gap from the free list. A rover on it moves to the next gap.
+static void _mem_unlink_gap(pool_mgr_pt pool_mgr, node_pt node)
+{
+    // the next gap may become the lowest in its region
+    unsigned region = 0;
+    if (pool_mgr->summary.max)
+    {
+        region = _mem_summary_region(pool_mgr, node);
+        if (pool_mgr->summary.first[region] == node)
         {
-            node_to_delete->next->prev = NULL;
-            node_to_delete->next = NULL;
+            node_pt next = node->free_next;
+            pool_mgr->summary.first[region] =
+                (next && _mem_summary_region(pool_mgr, next) == region)
+                ? next : NULL;
         }
     }
 
-    // this merged node-to-delete might need to be added to the gap index
-    // but one more thing to check...
-    // if the previous node in the list is also a gap, merge into previous!
-    if (node_to_delete->prev && !node_to_delete->prev->allocated)
+    if (node->free_prev)
     {
-        node_pt previous = node_to_delete->prev;
+        node->free_prev->free_next = node->free_next;
+    }
+    else
+    {
+        pool_mgr->free_head = node->free_next;
+    }
+    if (node->free_next)
+    {
+        node->free_next->free_prev = node->free_prev;
+    }
+    if (pool_mgr->rover == node)
+    {
+        pool_mgr->rover = node->free_next;
+    }
+    node->free_next = NULL;
+    node->free_prev = NULL;
+
+    // its region's largest gap may be smaller now
+    if (pool_mgr->summary.max)
+    {
+        _mem_summary_update(pool_mgr, region);
+    }
+}
+
+
+// Finds the closest gap above the given node, in the pool, i.e. the one
+// it goes after in the free list. NULL if there is none.
+// note: walks over the allocations in between
+static node_pt _mem_find_free_prev(node_pt node)
+{
+    node_pt prev = node->prev;
+    while (prev && (prev->allocated || prev->deferred))
+    {
+        prev = prev->prev;
+    }
+    return prev;
+}
+
+
+// Allocates the gap summary, with regions of at least the minimum size,
+// and no more regions than the maximum, and adds the top gap to it.
+static alloc_status _mem_new_gap_summary(pool_mgr_pt pool_mgr)
+{
+    gap_summary_pt summary = &pool_mgr->summary;
+    size_t total_size = pool_mgr->pool.total_size;
+
+    summary->region_size = MEM_GAP_SUMMARY_MIN_REGION;
+    while (total_size / summary->region_size >= MEM_GAP_SUMMARY_MAX_LEAVES)
+    {
+        summary->region_size *= 2;
+    }
+    summary->num_leaves = 1;
+    while ((size_t) summary->num_leaves * summary->region_size < total_size)
+    {
+        summary->num_leaves *= 2;
+    }
+
+    summary->max = (size_t*) calloc(2 * summary->num_leaves, sizeof(size_t));
+    summary->first = (node_pt*) calloc(summary->num_leaves, sizeof(node_pt));
+    if (!summary->max || !summary->first)
+    {
+        free(summary->max);
+        free(summary->first);
+        summary->max = NULL;
+        summary->first = NULL;
+        return ALLOC_FAIL;
+    }
+
+    summary->first[0] = pool_mgr->head;
+    _mem_summary_raise(pool_mgr, pool_mgr->head);
+    return ALLOC_OK;
+}
+
+
+// Returns the region of the pool the given gap starts in.
+static unsigned _mem_summary_region(pool_mgr_pt pool_mgr, node_pt node)
+{
+    size_t offset = (size_t) (node->alloc_record.mem - pool_mgr->pool.mem);
+    return (unsigned) (offset / pool_mgr->summary.region_size);
+}
+
+
+// Raises the summary up from the given gap's region to the gap's size.
+static void _mem_summary_raise(pool_mgr_pt pool_mgr, node_pt node)
+{
+    gap_summary_pt summary = &pool_mgr->summary;
+    size_t size = node->alloc_record.size;
+    unsigned i = summary->num_leaves + _mem_summary_region(pool_mgr, node);
+    for (; i && summary->max[i] < size; i /= 2)
+    {
+        summary->max[i] = size;
+    }
+}
+
+
+// Recounts the largest gap of a region from its gaps, and the summary
+// up from it.
+static void _mem_summary_update(pool_mgr_pt pool_mgr, unsigned region)
+{
+    gap_summary_pt summary = &pool_mgr->summary;
+    size_t max = 0;
+    node_pt gap = summary->first[region];
+    for (; gap && _mem_summary_region(pool_mgr, gap) == region;
+         gap = gap->free_next)
+    {
+        if (gap->alloc_record.size > max) max = gap->alloc_record.size;
+    }
+
+    unsigned i = summary->num_leaves + region;
+    summary->max[i] = max;
+    for (i /= 2; i; i /= 2)
+    {
+        size_t children = summary->max[2 * i] > summary->max[2 * i + 1]
+                          ? summary->max[2 * i] : summary->max[2 * i + 1];
+        if (summary->max[i] == children) break;
+        summary->max[i] = children;
+    }
+}
+
+
+// Summarizes the free list from scratch.
+static void _mem_summary_rebuild(pool_mgr_pt pool_mgr)
+{
+    gap_summary_pt summary = &pool_mgr->summary;
+    memset(summary->max, 0, 2 * summary->num_leaves * sizeof(size_t));
+    memset(summary->first, 0, summary->num_leaves * sizeof(node_pt));
+
+    node_pt gap = pool_mgr->free_head;
+    for (; gap; gap = gap->free_next)
+    {
+        unsigned region = _mem_summary_region(pool_mgr, gap);
+        unsigned i = summary->num_leaves + region;
+        if (!summary->first[region]) summary->first[region] = gap;
+        if (gap->alloc_record.size > summary->max[i])
+        {
+            summary->max[i] = gap->alloc_record.size;
+        }
+    }
+    for (unsigned i = summary->num_leaves - 1; i; --i)
+    {
+        summary->max[i] = summary->max[2 * i] > summary->max[2 * i + 1]
+                          ? summary->max[2 * i] : summary->max[2 * i + 1];
+    }
+}
+
+
+// Allocates the size class bins, and bins the top gap.
+static alloc_status _mem_new_fit_bins(pool_mgr_pt pool_mgr)
+{
+    fit_bins_pt bins = &pool_mgr->bins;
+    bins->heads = (node_pt*) calloc(MEM_FIT_BIN_CLASSES, sizeof(node_pt));
+    bins->map = (uint64_t*) calloc(MEM_FIT_BIN_CLASSES / 64, sizeof(uint64_t));
+    if (!bins->heads || !bins->map)
+    {
+        free(bins->heads);
+        free(bins->map);
+        bins->heads = NULL;
+        bins->map = NULL;
+        return ALLOC_FAIL;
+    }
+    bins->max_waste = MEM_GOOD_FIT_MAX_WASTE;
+
+    _mem_bin_gap(pool_mgr, pool_mgr->head, pool_mgr->head->alloc_record.size);
+    return ALLOC_OK;
+}
+
+
+// Returns the size class of the given size, the one of the largest class
+// boundary not above it.
+static unsigned _mem_size_class(size_t size)
+{
+    unsigned num_sub = 1u << MEM_FIT_BIN_SUB_BITS;
+    if (size < num_sub) return (unsigned) size;
+
+    unsigned log2 = MEM_FIT_BIN_SUB_BITS;
+    while (size >> (log2 + 1))
+    {
+        ++log2;
+    }
+    unsigned sub = (unsigned) (size >> (log2 - MEM_FIT_BIN_SUB_BITS)) & (num_sub - 1);
+    return ((log2 - MEM_FIT_BIN_SUB_BITS + 1) << MEM_FIT_BIN_SUB_BITS) + sub;
+}
+
+
+// Rounds the given size up to the closest class boundary.
+static size_t _mem_round_to_class(size_t size)
+{
+    if (size < (1u << MEM_FIT_BIN_SUB_BITS)) return size;
+
+    unsigned log2 = MEM_FIT_BIN_SUB_BITS;
+    while (size >> (log2 + 1))
+    {
+        ++log2;
+    }
+    size_t step = (size_t) 1 << (log2 - MEM_FIT_BIN_SUB_BITS);
+    if (size > (size_t) -1 - step) return size;
+    return (size + step - 1) & ~(step - 1);
+}
+
+
+// Returns how much GOOD_FIT rounds the given size up by, 0 if rounding it
+// up to its class boundary wastes more than the pool allows.
+static size_t _mem_good_fit_waste(pool_mgr_pt pool_mgr, size_t size)
+{
+    size_t waste = _mem_round_to_class(size) - size;
+    if (waste * 100 > (size_t) pool_mgr->bins.max_waste * size) return 0;
+    return waste;
+}
+
+
+// Puts a gap of the given size at the head of its class's list.
+static void _mem_bin_gap(pool_mgr_pt pool_mgr, node_pt node, size_t size)
+{
+    fit_bins_pt bins = &pool_mgr->bins;
+    unsigned c = _mem_size_class(size);
+
+    node->bin_prev = NULL;
+    node->bin_next = bins->heads[c];
+    if (node->bin_next)
+    {
+        node->bin_next->bin_prev = node;
+    }
+    bins->heads[c] = node;
+    bins->map[c / 64] |= (uint64_t) 1 << (c % 64);
+}
+
+
+// Takes a gap of the given size out of its class's list.
+static void _mem_unbin_gap(pool_mgr_pt pool_mgr, node_pt node, size_t size)
+{
+    fit_bins_pt bins = &pool_mgr->bins;
+    unsigned c = _mem_size_class(size);
+
+    if (node->bin_prev)
+    {
+        node->bin_prev->bin_next = node->bin_next;
+    }
+    else
+    {
+        bins->heads[c] = node->bin_next;
+    }
+    if (node->bin_next)
+    {
+        node->bin_next->bin_prev = node->bin_prev;
+    }
+    if (!bins->heads[c])
+    {
+        bins->map[c / 64] &= ~((uint64_t) 1 << (c % 64));
+    }
+    node->bin_next = NULL;
+    node->bin_prev = NULL;
+}
+
+
+// Returns the position of the lowest set bit, of a nonzero word.
+static unsigned _mem_lowest_bit(uint64_t bits)
+{
+#ifdef __GNUC__
+    return (unsigned) __builtin_ctzll(bits);
+#else
+    unsigned bit = 0;
+    while (!(bits & 1))
+    {
+        bits >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+
+// Keeps track of the dirty bytes of a gap that absorbs the one right after
+// it. Call before adding up the sizes.
+static void _mem_merge_dirty(node_pt node, node_pt absorbed)
+{
+    if (absorbed->dirty)
+    {
+        node->dirty = node->alloc_record.size + absorbed->dirty;
+    }
+}
+
+
+// Zeroes memory, with non-temporal stores if it is too large to be worth
+// pulling into the cache.
+static void _mem_zero(char *mem, size_t size)
+{
+#ifdef MEM_SCAN_X86
+    if (size >= MEM_ZERO_STREAM_MIN)
+    {
+        _mem_zero_stream(mem, size);
+        return;
+    }
+#endif
+    memset(mem, 0, size);
+}
+
+
+#ifdef MEM_SCAN_X86
+__attribute__((target("sse2")))
+static void _mem_zero_stream(char *mem, size_t size)
+{
+    // up to a 16-byte boundary, then 64 bytes a loop, then the rest
+    size_t head = (16 - ((uintptr_t) mem & 15)) & 15;
+    memset(mem, 0, head);
+    mem += head;
+    size -= head;
+
+    __m128i zero = _mm_setzero_si128();
+    for (; size >= 64; mem += 64, size -= 64)
+    {
+        _mm_stream_si128((__m128i *) mem, zero);
+        _mm_stream_si128((__m128i *) mem + 1, zero);
+        _mm_stream_si128((__m128i *) mem + 2, zero);
+        _mm_stream_si128((__m128i *) mem + 3, zero);
+    }
+    _mm_sfence();
+    memset(mem, 0, size);
+}
+#endif
+
+
+// Tells a node (1) from a slab record (MEM_SLAB_RECORD) and a direct
+// record (MEM_DIRECT_RECORD), by the used field they all start with.
+static unsigned _mem_record_kind(alloc_pt alloc)
+{
+    _Static_assert(offsetof(slab_record_t, used) == offsetof(node_t, used),
+                   "slab records and nodes must start alike");
+    _Static_assert(offsetof(direct_record_t, used) == offsetof(node_t, used),
+                   "direct records and nodes must start alike");
+    unsigned used;
+    memcpy(&used, (char *) alloc + offsetof(node_t, used), sizeof(used));
+    return used;
+}
+
+
+// Tells the kind of a record to deallocate, as _mem_record_kind() does.
+// A hardened build tells it from where the record is instead, and 0 if
+// it's not one of the pool's, without reading it (it may be freed).
+static unsigned _mem_del_kind(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+#ifdef MEM_POOL_HARDENED
+    if (_mem_owns_node(pool_mgr, (node_pt) alloc)) return 1;
+    for (unsigned u = 0; u < pool_mgr->num_direct; ++u)
+    {
+        if (pool_mgr->direct[u] == (direct_record_pt) alloc) return MEM_DIRECT_RECORD;
+    }
+    slab_record_pt record = (slab_record_pt) alloc;
+    for (slab_pt slab = pool_mgr->all_slabs; slab; slab = slab->pool_next)
+    {
+        if (record >= slab->records && record < slab->records + slab->num_blocks)
+        {
+            return ((char *) record - (char *) slab->records) %
+                   sizeof(slab_record_t) == 0 ? MEM_SLAB_RECORD : 0;
+        }
+    }
+    return 0;
+#else
+    (void) pool_mgr;
+    return _mem_record_kind(alloc);
+#endif
+}
+
+
+// The bytes of the pool a node takes up: its gap, or its allocation and
+// the waste after it (the rounding up of GOOD_FIT, and the canary).
+static size_t _mem_node_extent(node_pt node)
+{
+    if (node->allocated) return node->alloc_record.size + node->waste;
+    return node->alloc_record.size;
+}
+
+
+// Marks a node or a record as allocated or not.
+static void _mem_set_record_allocated(alloc_pt alloc, unsigned allocated)
+{
+    unsigned kind = _mem_record_kind(alloc);
+    if (kind == MEM_SLAB_RECORD)
+    {
+        ((slab_record_pt) alloc)->allocated = (unsigned short) allocated;
+    }
+    else if (kind == MEM_DIRECT_RECORD)
+    {
+        ((direct_record_pt) alloc)->allocated = allocated;
+    }
+    else
+    {
+        ((node_pt) alloc)->allocated = allocated;
+    }
+}
+
+
+// Finds the slab a record is in, from its slot.
+static slab_pt _mem_record_slab(slab_record_pt record)
+{
+    return (slab_pt) ((char *) (record - record->ix) - offsetof(slab_t, records));
+}
+
+
+// Allocates a block of the size class of the given (small) size, from
+// the first slab of the class with a free block, or a new slab.
+static alloc_pt _mem_new_small_alloc(pool_mgr_pt pool_mgr, size_t size)
+{
+    unsigned size_class = (unsigned) ((size - 1) / MEM_SLAB_CLASS_SIZE);
+
+    slab_pt slab = pool_mgr->slabs[size_class];
+    if (!slab)
+    {
+        slab = _mem_new_slab(pool_mgr, size_class);
+        if (!slab) return NULL;
+    }
+
+    // take the first free block, a full slab leaves the list
+    slab_record_pt record = &slab->records[slab->free_head];
+    slab->free_head = (unsigned) record->alloc_record.size;
+    if (--slab->num_free == 0) _mem_unlink_slab(pool_mgr, slab);
+    record->alloc_record.size = size;
+    record->allocated = 1;
+
+    // update metadata (num_allocs, alloc_size, internal_waste)
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.alloc_size += size;
+    pool_mgr->pool.internal_waste += (size_class + 1) * MEM_SLAB_CLASS_SIZE - size;
+    pool_mgr->slab_unused -= (size_class + 1) * MEM_SLAB_CLASS_SIZE;
+
+    return (alloc_pt) record;
+}
+
+
+// Puts a block back in its slab. A slab that empties is deallocated,
+// unless it's the only one of its class with a free block.
+static alloc_status _mem_del_small_alloc(pool_mgr_pt pool_mgr, slab_record_pt record)
+{
+    // check it's in use
+    if (!record->allocated)
+    {
+        MEM_FAULT(pool_mgr, &record->alloc_record, FAULT_BAD_FREE);
+        return ALLOC_FAIL;
+    }
+
+    slab_pt slab = _mem_record_slab(record);
+    size_t size = record->alloc_record.size;
+#ifdef MEM_POOL_HARDENED
+    _mem_poison(record->alloc_record.mem, size);
+#endif
+
+    // update metadata (num_allocs, alloc_size, internal_waste)
+    pool_mgr->pool.num_allocs--;
+    pool_mgr->pool.alloc_size -= size;
+    pool_mgr->pool.internal_waste -=
+        (slab->size_class + 1) * MEM_SLAB_CLASS_SIZE - size;
+    pool_mgr->slab_unused += (slab->size_class + 1) * MEM_SLAB_CLASS_SIZE;
+
+    // push the block on the slab's free list, the slab on its class list
+    record->allocated = 0;
+    record->alloc_record.size = slab->free_head;
+    slab->free_head = record->ix;
+    if (slab->num_free++ == 0) _mem_link_slab(pool_mgr, slab);
+
+    if (slab->num_free == slab->num_blocks && (slab->next || slab->prev))
+    {
+        return _mem_free_slab(pool_mgr, slab);
+    }
+    return ALLOC_OK;
+}
+
+
+// Allocates a slab of the given size class, in an allocation of the pool,
+// all its blocks free. Returns NULL if the pool (or malloc) is out of room.
+static slab_pt _mem_new_slab(pool_mgr_pt pool_mgr, unsigned size_class)
+{
+    pool_pt pool = &pool_mgr->pool;
+    size_t block_size = (size_class + 1) * MEM_SLAB_CLASS_SIZE;
+    unsigned num_blocks = (unsigned) (MEM_SLAB_SIZE / block_size);
+
+    slab_pt slab = (slab_pt) malloc(sizeof(slab_t) +
+                                    num_blocks * sizeof(slab_record_t));
+    if (!slab) return NULL;
+
+    // the blocks are one allocation of the pool, which is not counted
+    // as one (the blocks are, as they are allocated)
+    alloc_pt alloc = _mem_new_alloc(pool, num_blocks * block_size, pool->policy);
+    if (!alloc)
+    {
+        free(slab);
+        return NULL;
+    }
+    pool->num_allocs--;
+    pool->alloc_size -= alloc->size;
+    pool->internal_waste -= ((node_pt) alloc)->waste;
+    pool_mgr->slab_unused += _mem_node_extent((node_pt) alloc);
+
+    slab->node = (node_pt) alloc;
+    slab->node->slab = slab;
+    slab->size_class = size_class;
+    slab->num_blocks = num_blocks;
+    slab->num_free = num_blocks;
+    slab->free_head = 0;
+    for (unsigned u = 0; u < num_blocks; ++u)
+    {
+        slab_record_pt record = &slab->records[u];
+        record->alloc_record.size = u + 1;
+        record->alloc_record.mem = alloc->mem + u * block_size;
+        record->used = MEM_SLAB_RECORD;
+        record->ix = (unsigned short) u;
+        record->allocated = 0;
+    }
+    _mem_link_slab(pool_mgr, slab);
+#ifdef MEM_POOL_HARDENED
+    slab->pool_prev = NULL;
+    slab->pool_next = pool_mgr->all_slabs;
+    if (slab->pool_next) slab->pool_next->pool_prev = slab;
+    pool_mgr->all_slabs = slab;
+#endif
+    return slab;
+}
+
+
+// Deallocates an empty slab, and its allocation in the pool.
+static alloc_status _mem_free_slab(pool_mgr_pt pool_mgr, slab_pt slab)
+{
+    node_pt node = slab->node;
+
+    _mem_unlink_slab(pool_mgr, slab);
+#ifdef MEM_POOL_HARDENED
+    if (slab->pool_prev)
+    {
+        slab->pool_prev->pool_next = slab->pool_next;
+    }
+    else
+    {
+        pool_mgr->all_slabs = slab->pool_next;
+    }
+    if (slab->pool_next) slab->pool_next->pool_prev = slab->pool_prev;
+#endif
+    free(slab);
+
+    // counted back, to be uncounted by the deallocation
+    node->slab = NULL;
+    pool_mgr->slab_unused -= _mem_node_extent(node);
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.alloc_size += node->alloc_record.size;
+    pool_mgr->pool.internal_waste += node->waste;
+    return _mem_del_alloc(&pool_mgr->pool, (alloc_pt) node);
+}
+
+
+// Deallocates all the empty slabs, of every size class.
+static void _mem_free_empty_slabs(pool_mgr_pt pool_mgr)
+{
+    for (unsigned u = 0; u < MEM_SLAB_CLASSES; ++u)
+    {
+        slab_pt slab = pool_mgr->slabs[u];
+        while (slab)
+        {
+            slab_pt next = slab->next;
+            if (slab->num_free == slab->num_blocks)
+            {
+                _mem_free_slab(pool_mgr, slab);
+            }
+            slab = next;
+        }
+    }
+}
+
+
+// Puts a slab at the head of the list of its size class.
+static void _mem_link_slab(pool_mgr_pt pool_mgr, slab_pt slab)
+{
+    slab_pt *head = &pool_mgr->slabs[slab->size_class];
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head) (*head)->prev = slab;
+    *head = slab;
+}
+
+
+static void _mem_unlink_slab(pool_mgr_pt pool_mgr, slab_pt slab)
+{
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        pool_mgr->slabs[slab->size_class] = slab->next;
+    }
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+
+// Allocates the given (large) size in a mapping of its own, outside the
+// pool, and records it in the pool's direct table.
+static alloc_pt _mem_new_direct_alloc(pool_mgr_pt pool_mgr, size_t size)
+{
+#ifdef MEM_DIRECT_MAP
+    // expand the direct table, if necessary, quit on error
+    if (pool_mgr->num_direct == pool_mgr->direct_capacity)
+    {
+        unsigned capacity =
+            pool_mgr->direct_capacity * MEM_DIRECT_EXPAND_FACTOR;
+        direct_record_pt *direct = (direct_record_pt*)
+            realloc(pool_mgr->direct, capacity * sizeof(direct_record_pt));
+        if (!direct) return NULL;
+        pool_mgr->direct = direct;
+        pool_mgr->direct_capacity = capacity;
+    }
+
+    direct_record_pt record = (direct_record_pt) malloc(sizeof(direct_record_t));
+    if (!record) return NULL;
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t map_size = (size + page - 1) & ~(page - 1);
+    void *mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        free(record);
+        return NULL;
+    }
+
+    record->alloc_record.size = size;
+    record->alloc_record.mem = (char *) mem;
+    record->used = MEM_DIRECT_RECORD;
+    record->allocated = 1;
+    record->map_size = map_size;
+    record->ix = pool_mgr->num_direct;
+    pool_mgr->direct[pool_mgr->num_direct++] = record;
+
+    // update metadata (num_allocs, direct_size)
+    pool_mgr->pool.num_allocs++;
+    pool_mgr->pool.direct_size += size;
+
+    return (alloc_pt) record;
+#else
+    (void) pool_mgr;
+    (void) size;
+    return NULL;
+#endif
+}
+
+
+// Gives the mapping of a large allocation back to the OS, and drops it
+// from the direct table (the last one takes its slot).
+static alloc_status _mem_del_direct_alloc(pool_mgr_pt pool_mgr, direct_record_pt record)
+{
+#ifdef MEM_DIRECT_MAP
+    // check it's in use, and in the pool's table
+    if (!record->allocated
+#ifdef MEM_POOL_HARDENED
+        || record->ix >= pool_mgr->num_direct
+        || pool_mgr->direct[record->ix] != record
+#endif
+        )
+    {
+        MEM_FAULT(pool_mgr, &record->alloc_record, FAULT_BAD_FREE);
+        return ALLOC_FAIL;
+    }
+
+    if (munmap(record->alloc_record.mem, record->map_size)) return ALLOC_FAIL;
+
+    direct_record_pt last = pool_mgr->direct[--pool_mgr->num_direct];
+    pool_mgr->direct[record->ix] = last;
+    last->ix = record->ix;
+
+    // update metadata (num_allocs, direct_size)
+    pool_mgr->pool.num_allocs--;
+    pool_mgr->pool.direct_size -= record->alloc_record.size;
+
+    free(record);
+    return ALLOC_OK;
+#else
+    (void) pool_mgr;
+    (void) record;
+    return ALLOC_FAIL;
+#endif
+}
+
+
+// Tags the whole pool (down to a multiple of the alignment) as one gap.
+static void _mem_new_tag_pool(pool_mgr_pt pool_mgr)
+{
+    tag_gap_pt gap = (tag_gap_pt) pool_mgr->pool.mem;
+    size_t size = _mem_tag_end(pool_mgr) - pool_mgr->pool.mem;
+
+    _mem_tag_block(&gap->header, size, 0);
+    _mem_tag_link(pool_mgr, gap);
+    _mem_count_gap(&pool_mgr->pool, pool_mgr->pool.total_size, -1);
+    _mem_count_gap(&pool_mgr->pool, size, 1);
+    pool_mgr->pool.largest_gap = size;
+}
+
+
+// The end of the blocks of a boundary-tag pool.
+static char *_mem_tag_end(pool_mgr_pt pool_mgr)
+{
+    return pool_mgr->pool.mem + (pool_mgr->pool.total_size & ~(MEM_TAG_ALIGN - 1));
+}
+
+
+// The least block an allocation of the given size takes: the tags too,
+// aligned, and large enough to be a gap again.
+// note: wraps around (to less than size) for a size too large
+static size_t _mem_tag_need(size_t size)
+{
+    size_t need = (size + MEM_TAG_OVERHEAD + MEM_TAG_ALIGN - 1) & ~(MEM_TAG_ALIGN - 1);
+    return need < MEM_TAG_MIN_BLOCK && need >= size ? MEM_TAG_MIN_BLOCK : need;
+}
+
+
+// The size of a block, tags and all, from its header.
+static size_t _mem_tag_block_size(alloc_pt block)
+{
+    // a gap's size is its whole block, an allocation's is the one
+    // requested, after which is the tag of its block
+    if (!block->mem) return block->size;
+    return *(size_t *) ((char *) block + _mem_tag_need(block->size) - sizeof(size_t)) & ~(size_t) 1;
+}
+
+
+// Writes the header and the tags of a block of the given size, for an
+// allocation of payload bytes (a gap for 0).
+static void _mem_tag_block(alloc_pt block, size_t size, size_t payload)
+{
+    block->size = payload ? payload : size;
+    block->mem = payload ? (char *) (block + 1) : NULL;
+    *(size_t *) ((char *) block + size - sizeof(size_t)) = size | (payload != 0);
+    if (payload)
+    {
+        *(size_t *) ((char *) block + _mem_tag_need(payload) - sizeof(size_t)) = size | 1;
+    }
+}
+
+
+// Puts a gap at the head of the free list.
+static void _mem_tag_link(pool_mgr_pt pool_mgr, tag_gap_pt gap)
+{
+    gap->prev = NULL;
+    gap->next = pool_mgr->tag_free_head;
+    if (gap->next) gap->next->prev = gap;
+    pool_mgr->tag_free_head = gap;
+}
+
+
+static void _mem_tag_unlink(pool_mgr_pt pool_mgr, tag_gap_pt gap)
+{
+    if (gap->prev)
+    {
+        gap->prev->next = gap->next;
+    }
+    else
+    {
+        pool_mgr->tag_free_head = gap->next;
+    }
+    if (gap->next) gap->next->prev = gap->prev;
+}
+
+
+// Finds the largest gap on the free list of a boundary-tag pool.
+// note: stops at one of max_size, as none can be larger
+static size_t _mem_tag_largest_gap(pool_mgr_pt pool_mgr, size_t max_size)
+{
+    size_t largest = 0;
+    for (tag_gap_pt gap = pool_mgr->tag_free_head; gap; gap = gap->next)
+    {
+        if (gap->header.size > largest)
+        {
+            largest = gap->header.size;
+            if (largest == max_size) break;
+        }
+    }
+    return largest;
+}
+
+
+// Allocates from the free list of a boundary-tag pool: the first gap
+// that fits, or the smallest one for BEST_FIT.
+static alloc_pt _mem_new_tagged_alloc(pool_mgr_pt pool_mgr, size_t size, alloc_policy policy)
+{
+    pool_pt pool = &pool_mgr->pool;
+
+    size_t need = _mem_tag_need(size);
+    if (need < size) return NULL;
+
+    tag_gap_pt gap = pool_mgr->tag_free_head, fit = NULL;
+    if (policy == BEST_FIT)
+    {
+        for (; gap; gap = gap->next)
+        {
+            if (gap->header.size < need) continue;
+            if (!fit || gap->header.size < fit->header.size) fit = gap;
+            if (fit->header.size == need) break;
+        }
+    }
+    else
+    {
+        while (gap && gap->header.size < need) gap = gap->next;
+        fit = gap;
+    }
+    if (!fit) return NULL;
+
+    // split the gap, if the rest can be a gap, which takes its place in
+    // the free list, otherwise take all of it
+    size_t block_size = fit->header.size;
+    _mem_count_gap(pool, block_size, -1);
+    if (block_size - need >= MEM_TAG_MIN_BLOCK)
+    {
+        tag_gap_pt rest = (tag_gap_pt) ((char *) fit + need);
+        _mem_tag_block(&rest->header, block_size - need, 0);
+        rest->prev = fit->prev;
+        rest->next = fit->next;
+        if (rest->prev)
+        {
+            rest->prev->next = rest;
+        }
+        else
+        {
+            pool_mgr->tag_free_head = rest;
+        }
+        if (rest->next) rest->next->prev = rest;
+        _mem_count_gap(pool, block_size - need, 1);
+        block_size = need;
+    }
+    else
+    {
+        _mem_tag_unlink(pool_mgr, fit);
+        pool->num_gaps--;
+    }
+
+    // the largest gap only changes if it was taken from, then the next
+    // largest is looked for (a gap as large as it was ends the walk)
+    if (fit->header.size == pool->largest_gap)
+    {
+        pool->largest_gap = _mem_tag_largest_gap(pool_mgr, fit->header.size);
+    }
+
+    alloc_pt alloc = &fit->header;
+    _mem_tag_block(alloc, block_size, size);
+
+    // update metadata (num_allocs, alloc_size, internal_waste)
+    // note: the padding of the block is waste, its tags are not
+    pool->num_allocs++;
+    pool->alloc_size += size;
+    pool->internal_waste += block_size - MEM_TAG_OVERHEAD - size;
+    return alloc;
+}
+
+
+// Frees a block of a boundary-tag pool, merging it with the gaps right
+// before and after it, found from its own header and the footer before.
+static alloc_status _mem_del_tagged_alloc(pool_mgr_pt pool_mgr, alloc_pt alloc)
+{
+    pool_pt pool = &pool_mgr->pool;
+    char *end = _mem_tag_end(pool_mgr);
+
+    // check it's an allocation of the pool
+    if ((char *) alloc < pool->mem || (char *) alloc >= end ||
+        alloc->mem != (char *) (alloc + 1))
+    {
+        MEM_FAULT(pool_mgr, alloc, FAULT_BAD_FREE);
+        return ALLOC_FAIL;
+    }
+
+    size_t block_size = _mem_tag_block_size(alloc);
+
+#ifdef MEM_POOL_HARDENED
+    // the tag after the allocation (and its padding) is its canary, and
+    // one written over can't tell the block's size, so it stays as it is
+    size_t need = _mem_tag_need(alloc->size);
+    size_t tag = *(size_t *) ((char *) alloc + need - sizeof(size_t));
+    if (need < alloc->size || tag % MEM_TAG_ALIGN != 1 || block_size < need ||
+        block_size - need >= MEM_TAG_MIN_BLOCK ||
+        block_size > (size_t) (end - (char *) alloc))
+    {
+        MEM_FAULT(pool_mgr, alloc, FAULT_OVERRUN);
+        return ALLOC_FAIL;
+    }
+    if (*(size_t *) ((char *) alloc + block_size - sizeof(size_t)) != tag)
+    {
+        MEM_FAULT(pool_mgr, alloc, FAULT_OVERRUN);
+    }
+    _mem_poison(alloc->mem, alloc->size);
+#endif
+
+    // update metadata (num_allocs, alloc_size, internal_waste)
+    pool->num_allocs--;
+    pool->alloc_size -= alloc->size;
+    pool->internal_waste -= block_size - MEM_TAG_OVERHEAD - alloc->size;
+
+    // if the next block is a gap, take it in
+    alloc_pt next = (alloc_pt) ((char *) alloc + block_size);
+    if ((char *) next < end && !next->mem)
+    {
+        _mem_tag_unlink(pool_mgr, (tag_gap_pt) next);
+        _mem_count_gap(pool, next->size, -1);
+        pool->num_gaps--;
+        block_size += next->size;
+    }
+
+    // if the previous block is a gap, merge into it, in its place in the
+    // free list
+    if ((char *) alloc > pool->mem)
+    {
+        size_t prev_tag = *(size_t *) ((char *) alloc - sizeof(size_t));
+        if (!(prev_tag & 1))
+        {
+            alloc_pt prev = (alloc_pt) ((char *) alloc - prev_tag);
+            _mem_count_gap(pool, prev_tag, -1);
+            _mem_tag_block(prev, prev_tag + block_size, 0);
+            _mem_count_gap(pool, prev_tag + block_size, 1);
+            if (prev_tag + block_size > pool->largest_gap)
+            {
+                pool->largest_gap = prev_tag + block_size;
+            }
+            alloc->mem = NULL; // no longer an allocation, if freed again
+            return ALLOC_OK;
+        }
+    }
+
+    _mem_tag_block(alloc, block_size, 0);
+    _mem_tag_link(pool_mgr, (tag_gap_pt) alloc);
+    _mem_count_gap(pool, block_size, 1);
+    pool->num_gaps++;
+    if (block_size > pool->largest_gap)
+    {
+        pool->largest_gap = block_size;
+    }
+    return ALLOC_OK;
+}
+
+
+// Frees the blocks of a boundary-tag pool one by one, if they are all
+// allocations, and none is repeated.
+static alloc_status _mem_del_tagged_batch(pool_mgr_pt pool_mgr,
+                                          alloc_pt *allocs,
+                                          unsigned num_allocs)
+{
+    char *end = _mem_tag_end(pool_mgr);
+
+    // mark them all (as gaps), on a bad or repeated one undo and quit
+    for (unsigned u = 0; u < num_allocs; ++u)
+    {
+        alloc_pt alloc = allocs[u];
+        if (!alloc || (char *) alloc < pool_mgr->pool.mem || (char *) alloc >= end ||
+            alloc->mem != (char *) (alloc + 1))
+        {
+            MEM_FAULT(pool_mgr, alloc, FAULT_BAD_FREE);
+            while (u-- > 0)
+            {
+                allocs[u]->mem = (char *) (allocs[u] + 1);
+            }
+            return ALLOC_FAIL;
+        }
+        alloc->mem = NULL;
+    }
+
+    // unmarked first, or a marked block would pass for a gap next to one
+    for (unsigned u = 0; u < num_allocs; ++u)
+    {
+        allocs[u]->mem = (char *) (allocs[u] + 1);
+    }
+    for (unsigned u = 0; u < num_allocs; ++u)
+    {
+        alloc_status status = _mem_del_tagged_alloc(pool_mgr, allocs[u]);
+        MEM_TRACE(TRACE_DEL_ALLOC, &pool_mgr->pool, allocs[u], 0, status);
+        (void) status;
+    }
+    return ALLOC_OK;
+}
+
+
+#ifdef MEM_POOL_HARDENED
+// Tells if a node is in the node heap of the pool, so that a record of
+// another pool (or none) is not taken for one.
+static unsigned _mem_owns_node(pool_mgr_pt pool_mgr, node_pt node)
+{
+    for (unsigned c = 0; c < pool_mgr->num_chunks; ++c)
+    {
+        node_chunk_pt chunk = &pool_mgr->node_heap[c];
+        if (node >= chunk->nodes && node < chunk->nodes + chunk->num_nodes)
+        {
+            return ((char *) node - (char *) chunk->nodes) % sizeof(node_t) == 0;
+        }
+    }
+    return 0;
+}
+
+
+// Writes the canary right after an allocation, in the waste of its node.
+static void _mem_arm_guard(node_pt node)
+{
+    node->guarded = 1;
+    char *guard = node->alloc_record.mem + node->alloc_record.size;
+    for (size_t off = 0; off < MEM_GUARD_SIZE; off += sizeof(MEM_CANARY))
+    {
+        memcpy(guard + off, &MEM_CANARY, sizeof(MEM_CANARY));
+    }
+}
+
+
+// Tells if the canary of a guarded allocation is as it was written.
+static unsigned _mem_guard_intact(node_pt node)
+{
+    char *guard = node->alloc_record.mem + node->alloc_record.size;
+    for (size_t off = 0; off < MEM_GUARD_SIZE; off += sizeof(MEM_CANARY))
+    {
+        if (memcmp(guard + off, &MEM_CANARY, sizeof(MEM_CANARY))) return 0;
+    }
+    return 1;
+}
+
+
+// Reports an overrun, if the canary of a guarded allocation was written
+// over, and unguards it.
+// note: the canary's bytes go back to the node with the rest of its waste
+static void _mem_check_guard(pool_mgr_pt pool_mgr, node_pt node)
+{
+    if (!node->guarded) return;
+
+    if (!_mem_guard_intact(node))
+    {
+        MEM_FAULT(pool_mgr, &node->alloc_record, FAULT_OVERRUN);
+    }
+    node->guarded = 0;
+}
+
+
+// Fills the start of freed memory with MEM_POISON, so that a read after
+// the deallocation doesn't find the old data.
+static void _mem_poison(char *mem, size_t size)
+{
+    memset(mem, MEM_POISON, size < MEM_POISON_MAX ? size : MEM_POISON_MAX);
+}
+#endif
+
+
+// Finds the unused node in the lowest slot of the node heap.
+static node_pt _find_unused_node(pool_mgr_pt pool_mgr)
+{
+    // skip the chunks below the hint
+    unsigned c = 0, first = pool_mgr->unused_hint;
+    while (c < pool_mgr->num_chunks && first >= pool_mgr->node_heap[c].num_nodes)
+    {
+        first -= pool_mgr->node_heap[c++].num_nodes;
+    }
+
+    for (; c < pool_mgr->num_chunks; ++c, first = 0)
+    {
+        node_chunk_pt chunk = &pool_mgr->node_heap[c];
+        for (unsigned i = first; i < chunk->num_nodes; ++i)
+        {
+            if (!chunk->nodes[i].used)
+            {
+                pool_mgr->unused_hint = chunk->nodes[i].ix + 1;
+                return &chunk->nodes[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+
+alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+#ifdef MEM_POOL_STATS
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    unsigned long start = _mem_now_ns();
+
+    alloc_status status = _mem_del_alloc(pool, alloc);
+
+    _mem_stats_record(pool_mgr->stats.del_ns_hist, _mem_now_ns() - start);
+#else
+    alloc_status status = _mem_del_alloc(pool, alloc);
+#endif
+    MEM_TRACE(TRACE_DEL_ALLOC, pool, alloc, 0, status);
+    return status;
+}
+
+
+static alloc_status _mem_del_alloc(pool_pt pool, alloc_pt alloc) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a boundary-tag pool has no node heap
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        return _mem_del_tagged_alloc(pool_mgr, alloc);
+    }
+
+    // a small allocation goes back to its slab, a large one to the OS
+    unsigned kind = _mem_del_kind(pool_mgr, alloc);
+    if (kind == MEM_SLAB_RECORD)
+    {
+        return _mem_del_small_alloc(pool_mgr, (slab_record_pt) alloc);
+    }
+    if (kind == MEM_DIRECT_RECORD)
+    {
+        return _mem_del_direct_alloc(pool_mgr, (direct_record_pt) alloc);
+    }
+
+    // get node from alloc by casting the pointer to (node_pt)
+    node_pt node_to_delete = (node_pt) alloc;
+
+    // check it's a live allocation, not a gap or a node merged away
+    // note: or, in a hardened build, a record of another pool (or none)
+    if (!kind || !node_to_delete->used || !node_to_delete->allocated)
+    {
+        MEM_FAULT(pool_mgr, alloc, FAULT_BAD_FREE);
+        return ALLOC_FAIL;
+    }
+
+#ifdef MEM_POOL_HARDENED
+    _mem_check_guard(pool_mgr, node_to_delete);
+    _mem_poison(alloc->mem, alloc->size);
+#endif
+
+    // update metadata (num_allocs, alloc_size, internal_waste)
+    pool->num_allocs--;
+    pool->alloc_size -= alloc->size;
+    pool->internal_waste -= node_to_delete->waste;
+
+    // convert to gap node of all the node's bytes, waste included, which
+    // the user may have written all over
+    node_to_delete->allocated = 0;
+    alloc->size += node_to_delete->waste;
+    node_to_delete->waste = 0;
+    node_to_delete->dirty = alloc->size;
+
+    // with deferred coalescing, park the node on its quick list instead
+    if (pool_mgr->quick_budget)
+    {
+        _mem_push_quick_list(pool_mgr, node_to_delete);
+
+        // over budget, merge everything
+        if (pool_mgr->num_quick > pool_mgr->quick_budget)
+        {
+            return _mem_coalesce_all(pool_mgr);
+        }
+        return ALLOC_OK;
+    }
+
+    // the gap the node goes after in the free list, if it stays a node
+    node_pt free_prev = NULL;
+    unsigned found_free_prev = 0;
+
+    // if the next node in the list is also a gap, merge into node-to-delete
+    if (node_to_delete->next && !node_to_delete->next->allocated)
+    {
+        node_pt next = node_to_delete->next;
+
+        // add the size to the node-to-delete
+        _mem_merge_dirty(node_to_delete, next);
+        alloc->size += next->alloc_record.size;
+
+        // remove the next node from gap index (and the free list)
+        // note: node-to-delete takes its place in the free list
+        _mem_remove_from_gap_ix(pool_mgr, next->alloc_record.size, next);
+        free_prev = next->free_prev;
+        found_free_prev = 1;
+        _mem_unlink_gap(pool_mgr, next);
+
+        // update linked list:
+        node_to_delete->next = next->next;
+        if (next->next)
+        {
+            next->next->prev = node_to_delete;
+        }
+
+        // update node as unused (and metadata)
+        _mem_release_node(pool_mgr, next);
+    }
+
+    // this merged node-to-delete might need to be added to the gap index
+    // but one more thing to check...
+    // if the previous node in the list is also a gap, merge into previous!
+    if (node_to_delete->prev && !node_to_delete->prev->allocated)
+    {
+        node_pt previous = node_to_delete->prev;
 
         // remove the previous node from gap index
         alloc_status status =
@@ -486,69 +2424,1130 @@ alloc_status mem_del_alloc(pool_pt pool, alloc_pt alloc) {
         // check success
         if (status == ALLOC_FAIL) return status;
 
-        // add the size of node-to-delete to the previous
-        previous->alloc_record.size += alloc->size;
+        // add the size of node-to-delete to the previous
+        _mem_merge_dirty(previous, node_to_delete);
+        previous->alloc_record.size += alloc->size;
+        if (pool_mgr->summary.max)
+        {
+            _mem_summary_raise(pool_mgr, previous);
+        }
+
+        // update linked list
+        previous->next = node_to_delete->next;
+        if (node_to_delete->next)
+        {
+            node_to_delete->next->prev = previous;
+        }
+
+        // update node-to-delete as unused (and metadata)
+        _mem_release_node(pool_mgr, node_to_delete);
+
+        // change the node to add to the previous node!
+        // note: it's already in the free list
+        node_to_delete = previous;
+    }
+    else
+    {
+        // link the node into the free list
+        if (!found_free_prev) free_prev = _mem_find_free_prev(node_to_delete);
+        _mem_link_gap(pool_mgr, node_to_delete, free_prev);
+    }
+
+    // add the resulting node to the gap index
+    _mem_add_to_gap_ix(pool_mgr,
+                       node_to_delete->alloc_record.size,
+                       node_to_delete);
+
+    return ALLOC_OK;
+}
+
+
+alloc_status mem_del_alloc_batch(pool_pt pool,
+                                 alloc_pt *allocs,
+                                 unsigned num_allocs) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a boundary-tag pool merges as it goes anyway
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        return _mem_del_tagged_batch(pool_mgr, allocs, num_allocs);
+    }
+
+    // room for every node as a gap of its own (deferred ones too), in
+    // case none of them merge, so the gap index can be rebuilt after
+    if (_mem_reserve_gap_ix(pool_mgr, pool->num_gaps + pool_mgr->num_quick +
+                                      num_allocs) == ALLOC_FAIL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    // convert all the nodes to gap nodes, without merging yet
+    // note: the small and large allocations are only marked, for now
+    // on a bad or repeated allocation, undo the marking and quit
+    unsigned num_records = 0;
+    for (unsigned u = 0; u < num_allocs; ++u)
+    {
+        unsigned kind = allocs[u] ? _mem_del_kind(pool_mgr, allocs[u]) : 0;
+        if (kind == MEM_SLAB_RECORD || kind == MEM_DIRECT_RECORD)
+        {
+            if ((kind == MEM_SLAB_RECORD &&
+                 ((slab_record_pt) allocs[u])->allocated) ||
+                (kind == MEM_DIRECT_RECORD &&
+                 ((direct_record_pt) allocs[u])->allocated))
+            {
+                _mem_set_record_allocated(allocs[u], 0);
+                num_records++;
+                continue;
+            }
+        }
+        else if (kind)
+        {
+            node_pt node = (node_pt) allocs[u];
+            if (node->used && node->allocated)
+            {
+                node->dirty = _mem_node_extent(node);
+                node->allocated = 0;
+                continue;
+            }
+        }
+
+        MEM_FAULT(pool_mgr, allocs[u], FAULT_BAD_FREE);
+        while (u-- > 0)
+        {
+            _mem_set_record_allocated(allocs[u], 1);
+        }
+        return ALLOC_FAIL;
+    }
+
+    // update metadata (num_allocs, alloc_size, internal_waste)
+    for (unsigned u = 0; u < num_allocs; ++u)
+    {
+        if (_mem_record_kind(allocs[u]) != 1) continue;
+#ifdef MEM_POOL_HARDENED
+        _mem_check_guard(pool_mgr, (node_pt) allocs[u]);
+        _mem_poison(allocs[u]->mem, allocs[u]->size);
+#endif
+        pool->num_allocs--;
+        pool->alloc_size -= allocs[u]->size;
+        pool->internal_waste -= ((node_pt) allocs[u])->waste;
+        allocs[u]->size += ((node_pt) allocs[u])->waste;
+        ((node_pt) allocs[u])->waste = 0;
+        MEM_TRACE(TRACE_DEL_ALLOC, pool, allocs[u], 0, ALLOC_OK);
+    }
+
+    // one sweep merges all adjacent gaps (deferred ones too)
+    // and the gap index is rebuilt once for all of them
+    alloc_status status = _mem_coalesce_all(pool_mgr);
+
+    // the small and large allocations are deallocated one by one, now
+    // that the pool is in order again (a slab that empties is, too)
+    // note: the nodes merged away are unused now, so are told apart too
+    for (unsigned u = 0; num_records && u < num_allocs; ++u)
+    {
+        unsigned kind = _mem_record_kind(allocs[u]);
+        if (kind != MEM_SLAB_RECORD && kind != MEM_DIRECT_RECORD) continue;
+        MEM_TRACE(TRACE_DEL_ALLOC, pool, allocs[u], 0, ALLOC_OK);
+        _mem_set_record_allocated(allocs[u], 1);
+        _mem_del_alloc(pool, allocs[u]);
+        num_records--;
+    }
+    return status;
+}
+
+
+alloc_status mem_pool_set_deferred_coalescing(pool_pt pool, unsigned budget) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a boundary-tag pool merges right away
+    if (budget && pool_mgr->layout == LAYOUT_BOUNDARY_TAG) return ALLOC_FAIL;
+
+    // turning it off (or down) merges whatever has been deferred so far
+    if (pool_mgr->num_quick > budget)
+    {
+        alloc_status status = _mem_coalesce_all(pool_mgr);
+        if (status == ALLOC_FAIL) return status;
+    }
+
+    // allocate the quick list bins on first use
+    if (budget && !pool_mgr->quick_lists)
+    {
+        pool_mgr->quick_lists =
+            (node_pt*) calloc(MEM_QUICK_LIST_BINS, sizeof(node_pt));
+        if (!pool_mgr->quick_lists) return ALLOC_FAIL;
+    }
+
+    pool_mgr->quick_budget = budget;
+    MEM_TRACE(TRACE_POOL_CONFIG, pool, NULL, budget, TRACE_SET_DEFERRED_COALESCING);
+    return ALLOC_OK;
+}
+
+
+alloc_status mem_pool_set_max_waste(pool_pt pool, unsigned percent) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // only GOOD_FIT rounds sizes up
+    if (pool->policy != GOOD_FIT) return ALLOC_FAIL;
+
+    pool_mgr->bins.max_waste = percent;
+    MEM_TRACE(TRACE_POOL_CONFIG, pool, NULL, percent, TRACE_SET_MAX_WASTE);
+    return ALLOC_OK;
+}
+
+
+alloc_status mem_pool_set_small_objects(pool_pt pool, size_t max_size) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // only as large as the largest size class, and not in boundary tags
+    if (max_size > MEM_SLAB_CLASSES * MEM_SLAB_CLASS_SIZE) return ALLOC_FAIL;
+    if (max_size && pool_mgr->layout == LAYOUT_BOUNDARY_TAG) return ALLOC_FAIL;
+
+    // allocate the slab lists on first use
+    if (max_size && !pool_mgr->slabs)
+    {
+        pool_mgr->slabs = (slab_pt*) calloc(MEM_SLAB_CLASSES, sizeof(slab_pt));
+        if (!pool_mgr->slabs) return ALLOC_FAIL;
+    }
+
+    // turning it off gives the empty slabs back
+    // note: the blocks still in use stay where they are until deallocated
+    pool_mgr->small_max = max_size;
+    if (!max_size && pool_mgr->slabs) _mem_free_empty_slabs(pool_mgr);
+    MEM_TRACE(TRACE_POOL_CONFIG, pool, NULL, max_size, TRACE_SET_SMALL_OBJECTS);
+    return ALLOC_OK;
+}
+
+
+alloc_status mem_pool_set_direct_map(pool_pt pool, size_t min_size) {
+#ifdef MEM_DIRECT_MAP
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a slab (or anything smaller) doesn't get a mapping, and a
+    // boundary-tag pool has no room to tell a mapping from a block
+    if (min_size && min_size <= MEM_SLAB_SIZE) return ALLOC_FAIL;
+    if (min_size && pool_mgr->layout == LAYOUT_BOUNDARY_TAG) return ALLOC_FAIL;
+
+    // allocate the direct table on first use
+    if (min_size && !pool_mgr->direct)
+    {
+        pool_mgr->direct = (direct_record_pt*)
+            calloc(MEM_DIRECT_INIT_CAPACITY, sizeof(direct_record_pt));
+        if (!pool_mgr->direct) return ALLOC_FAIL;
+        pool_mgr->direct_capacity = MEM_DIRECT_INIT_CAPACITY;
+    }
+
+    // note: the mappings already made stay until deallocated
+    pool_mgr->direct_min = min_size ? min_size : SIZE_MAX;
+    MEM_TRACE(TRACE_POOL_CONFIG, pool, NULL, min_size, TRACE_SET_DIRECT_MAP);
+    return ALLOC_OK;
+#else
+    // not supported on this platform
+    (void) pool;
+    (void) min_size;
+    return ALLOC_FAIL;
+#endif
+}
+
+
+size_t mem_pool_trim(pool_pt pool) {
+#ifdef MEM_TRIM
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+
+    // not done in boundary tags, which are in the gaps
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG) return 0;
+
+    // deferred blocks are merged first, so they can be released whole
+    if (pool_mgr->num_quick) _mem_coalesce_all(pool_mgr);
+
+    // the pages in the dirty part of every gap go back to the OS, which
+    // maps them to zeros again, and the bytes around them are zeroed
+    node_pt node = pool_mgr->head;
+    for (; node; node = node->next)
+    {
+        if (node->allocated || !node->dirty) continue;
+
+        uintptr_t start = (uintptr_t) node->alloc_record.mem;
+        uintptr_t dirty_end = start + node->dirty;
+        uintptr_t first = (start + page - 1) & ~(page - 1);
+        uintptr_t last = (start + node->alloc_record.size) & ~(page - 1);
+        if (last > ((dirty_end + page - 1) & ~(page - 1)))
+        {
+            last = (dirty_end + page - 1) & ~(page - 1);
+        }
+        if (first >= last) continue;
+
+        if (madvise((void *) first, last - first, MADV_DONTNEED)) continue;
+        released += last - first;
+        if (dirty_end > last)
+        {
+            memset((void *) last, 0, dirty_end - last);
+        }
+        node->dirty = first - start;
+    }
+    return released;
+#else
+    // not supported on this platform
+    (void) pool;
+    return 0;
+#endif
+}
+
+
+// Merges all deferred nodes and adjacent gaps, and rebuilds the gap index.
+// On error, nothing has changed.
+static alloc_status _mem_coalesce_all(pool_mgr_pt pool_mgr)
+{
+    // room for every deferred node as a gap of its own, in case none
+    // of them merge
+    if (_mem_reserve_gap_ix(pool_mgr, pool_mgr->pool.num_gaps +
+                                      pool_mgr->num_quick) == ALLOC_FAIL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    // empty the quick lists, the nodes become ordinary gaps
+    for (unsigned u = 0; pool_mgr->num_quick && u < MEM_QUICK_LIST_BINS; ++u)
+    {
+        node_pt node = pool_mgr->quick_lists[u];
+        while (node)
+        {
+            node_pt next = node->quick_next;
+            node->deferred = 0;
+            node->quick_next = NULL;
+            pool_mgr->num_quick--;
+            node = next;
+        }
+        pool_mgr->quick_lists[u] = NULL;
+    }
+
+    _mem_coalesce_gaps(pool_mgr);
+    return _mem_rebuild_gap_ix(pool_mgr);
+}
+
+
+// Parks a freed node on the quick list for its size.
+static void _mem_push_quick_list(pool_mgr_pt pool_mgr, node_pt node)
+{
+    unsigned bin = node->alloc_record.size % MEM_QUICK_LIST_BINS;
+    node->deferred = 1;
+    node->quick_next = pool_mgr->quick_lists[bin];
+    pool_mgr->quick_lists[bin] = node;
+    pool_mgr->num_quick++;
+}
+
+
+// Takes a deferred node of exactly the given size off its quick list,
+// and turns it back into an allocation. Returns NULL if there is none.
+static node_pt _mem_pop_quick_list(pool_mgr_pt pool_mgr, size_t size)
+{
+    if (!pool_mgr->num_quick) return NULL;
+
+    node_pt *link = &pool_mgr->quick_lists[size % MEM_QUICK_LIST_BINS];
+    for (; *link; link = &(*link)->quick_next)
+    {
+        node_pt node = *link;
+        if (node->alloc_record.size == size)
+        {
+            *link = node->quick_next;
+            node->quick_next = NULL;
+            node->deferred = 0;
+            node->allocated = 1;
+            pool_mgr->num_quick--;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+
+// Merges every run of adjacent gaps in the linked list into its first node.
+static void _mem_coalesce_gaps(pool_mgr_pt pool_mgr)
+{
+    node_pt node = pool_mgr->head;
+    for (; node; node = node->next)
+    {
+        if (node->allocated) continue;
+
+        while (node->next && !node->next->allocated)
+        {
+            node_pt absorbed = node->next;
+
+            // add the size to the first gap of the run
+            _mem_merge_dirty(node, absorbed);
+            node->alloc_record.size += absorbed->alloc_record.size;
+
+            // update linked list
+            node->next = absorbed->next;
+            if (absorbed->next)
+            {
+                absorbed->next->prev = node;
+            }
+
+            // update node as unused (and metadata)
+            _mem_release_node(pool_mgr, absorbed);
+        }
+    }
+}
+
+
+float mem_pool_ext_frag(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // the free bytes are those an allocation could get: the gaps (and
+    // deferred blocks, not in any gap yet), not the waste of the
+    // allocations, nor the slabs' free blocks
+    size_t free_size = pool->total_size - pool->alloc_size - pool->internal_waste -
+                       pool_mgr->slab_unused;
+    size_t largest_gap = pool->largest_gap;
+
+    // nor, in a boundary-tag pool, the slack after the last block and the
+    // tags, of the allocations and of the gaps (a gap of largest_gap
+    // bytes takes an allocation of that less the tags)
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        if (!pool->num_gaps) return 0.0f;
+        free_size = (size_t) (_mem_tag_end(pool_mgr) - pool->mem) - pool->alloc_size -
+                    pool->internal_waste -
+                    (pool->num_allocs + pool->num_gaps) * MEM_TAG_OVERHEAD;
+        largest_gap -= MEM_TAG_OVERHEAD;
+    }
+    if (!free_size) return 0.0f;
+
+    return 1.0f - (float) largest_gap / free_size;
+}
+
+
+alloc_status mem_trace_start(const char *path) {
+#ifdef MEM_POOL_TRACE
+    // only one trace at a time
+    if (trace_file) return ALLOC_CALLED_AGAIN;
+
+    trace_file = fopen(path, "wb");
+    if (!trace_file) return ALLOC_FAIL;
+
+    mem_trace_header_t header = { MEM_TRACE_MAGIC, MEM_TRACE_VERSION,
+                                  sizeof(mem_trace_record_t) };
+    fwrite(&header, sizeof(header), 1, trace_file);
+    trace_start_ns = _mem_now_ns();
+    return ALLOC_OK;
+#else
+    // not supported in this build
+    (void) path;
+    return ALLOC_FAIL;
+#endif
+}
+
+
+alloc_status mem_trace_stop() {
+#ifdef MEM_POOL_TRACE
+    if (!trace_file) return ALLOC_CALLED_AGAIN;
+
+    int error = fclose(trace_file);
+    trace_file = NULL;
+    return error ? ALLOC_FAIL : ALLOC_OK;
+#else
+    return ALLOC_FAIL;
+#endif
+}
+
+
+alloc_status mem_pool_stats(pool_pt pool, pool_stats_pt stats) {
+#ifdef MEM_POOL_STATS
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    *stats = pool_mgr->stats;
+    return ALLOC_OK;
+#else
+    // not recorded in this build
+    (void) pool;
+    (void) stats;
+    return ALLOC_FAIL;
+#endif
+}
+
+
+#ifdef MEM_POOL_HARDENED
+// The default fault handler, which writes the fault to stderr.
+static void _mem_report_fault(pool_pt pool, alloc_pt alloc, mem_fault fault)
+{
+    fprintf(stderr, "mem_pool: %s of allocation %p in pool %p\n",
+            fault == FAULT_OVERRUN ? "overrun" : "bad deallocation",
+            (void *) alloc, (void *) pool);
+}
+#endif
+
+
+alloc_status mem_set_fault_handler(mem_fault_fn fn) {
+#ifdef MEM_POOL_HARDENED
+    fault_handler = fn ? fn : _mem_report_fault;
+    return ALLOC_OK;
+#else
+    // nothing is checked in this build
+    (void) fn;
+    return ALLOC_FAIL;
+#endif
+}
+
+
+alloc_status mem_pool_set_guard_sample(pool_pt pool, unsigned period) {
+#ifdef MEM_POOL_HARDENED
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a boundary-tag pool has a footer after every allocation anyway
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG) return ALLOC_FAIL;
+
+    pool_mgr->guard_period = period;
+    pool_mgr->guard_countdown = period;
+    MEM_TRACE(TRACE_POOL_CONFIG, pool, NULL, period, TRACE_SET_GUARD_SAMPLE);
+    return ALLOC_OK;
+#else
+    // nothing is checked in this build
+    (void) pool;
+    (void) period;
+    return ALLOC_FAIL;
+#endif
+}
+
+
+// Returns the upper bound (in ns) of the latency histogram bucket
+// that the given percentile (0-100) of the recorded calls falls in.
+unsigned long mem_latency_percentile(const unsigned long *hist,
+                                     double percentile) {
+    unsigned long total = 0;
+    for (unsigned u = 0; u < MEM_LATENCY_BUCKETS; ++u)
+    {
+        total += hist[u];
+    }
+    if (!total) return 0;
+
+    // bucket u holds [lower(u), lower(u + 1)), see _mem_stats_record
+    unsigned long rank = (unsigned long) (percentile / 100.0 * total);
+    unsigned long seen = 0;
+    unsigned u = 0;
+    for (; u < MEM_LATENCY_BUCKETS - 1; ++u)
+    {
+        seen += hist[u];
+        if (seen > rank) break;
+    }
+    ++u;
+    if (u < 4) return u;
+    return (unsigned long) (4 + u % 4) << (u / 4 - 1);
+}
+
+
+alloc_status mem_set_scan_kernel(scan_kernel kernel) {
+#ifdef MEM_SCAN_X86
+    __builtin_cpu_init();
+    unsigned has_sse42 = __builtin_cpu_supports("sse4.2");
+    unsigned has_avx2 = __builtin_cpu_supports("avx2");
+#else
+    unsigned has_sse42 = 0, has_avx2 = 0;
+#endif
+
+    // the widest one the CPU (and the build) supports
+    if (kernel == SCAN_AUTO)
+    {
+        kernel = has_avx2 ? SCAN_AVX2 : has_sse42 ? SCAN_SSE42 : SCAN_SCALAR;
+    }
+
+    switch (kernel)
+    {
+        case SCAN_SCALAR:
+            scan_fit = _mem_scan_fit_scalar;
+            break;
+#ifdef MEM_SCAN_X86
+        case SCAN_SSE42:
+            if (!has_sse42) return ALLOC_FAIL;
+            scan_fit = _mem_scan_fit_sse42;
+            break;
+        case SCAN_AVX2:
+            if (!has_avx2) return ALLOC_FAIL;
+            scan_fit = _mem_scan_fit_avx2;
+            break;
+#endif
+        default:
+            return ALLOC_FAIL;
+    }
+    scan_fit_kernel = kernel;
+    return ALLOC_OK;
+}
+
+
+scan_kernel mem_scan_kernel() {
+    if (!scan_fit) mem_set_scan_kernel(SCAN_AUTO);
+    return scan_fit_kernel;
+}
+
+
+alloc_status mem_pool_compact(pool_pt pool) {
+    // a single step without a limit goes all the way
+    size_t moved = 0;
+    return _mem_compact((pool_mgr_pt) pool, (size_t) -1, &moved);
+}
+
+
+size_t mem_pool_compact_step(pool_pt pool, size_t max_bytes) {
+    // on error, nothing has moved
+    size_t moved = 0;
+    _mem_compact((pool_mgr_pt) pool, max_bytes, &moved);
+    return moved;
+}
+
+
+// Slides allocations up over the gaps, until at least max_bytes have
+// moved (and at least one allocation), adding the bytes to moved.
+// On error, nothing has moved.
+static alloc_status _mem_compact(pool_mgr_pt pool_mgr, size_t max_bytes, size_t *moved)
+{
+    // blocks with boundary tags don't move, nor do pinned pools
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG || pool_mgr->num_pins) return ALLOC_FAIL;
+
+    // deferred blocks are merged first, so they can be moved over
+    if (pool_mgr->num_quick &&
+        _mem_coalesce_all(pool_mgr) == ALLOC_FAIL) return ALLOC_FAIL;
+
+    // find the first gap, everything above it is already compacted
+    node_pt gap = pool_mgr->head;
+    while (gap && gap->allocated) gap = gap->next;
+    if (!gap) return ALLOC_OK;
+
+    // gaps only merge from here on, so with room for the ones there
+    // are, the gap index can be rebuilt after
+    if (_mem_reserve_gap_ix(pool_mgr, pool_mgr->pool.num_gaps) == ALLOC_FAIL)
+    {
+        return ALLOC_FAIL;
+    }
+
+    // slide the allocations below the gap up over it, one at a time,
+    // merging into the gap every other gap it meets on the way down
+    while (gap->next)
+    {
+        node_pt next = gap->next;
+        if (!next->allocated)
+        {
+            _mem_merge_dirty(gap, next);
+            gap->alloc_record.size += next->alloc_record.size;
+            gap->next = next->next;
+            if (next->next)
+            {
+                next->next->prev = gap;
+            }
+            _mem_release_node(pool_mgr, next);
+            continue;
+        }
+
+        // always move at least one allocation
+        if (*moved && *moved >= max_bytes) break;
+
+        *moved += _mem_node_extent(next);
+        _mem_slide_alloc(pool_mgr, next);
+    }
+
+    // gaps were moved and merged, so reindex them once
+    return _mem_rebuild_gap_ix(pool_mgr);
+}
+
+
+alloc_status mem_pool_pin(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // check the count doesn't wrap around
+    if (pool_mgr->num_pins == UINT_MAX) return ALLOC_FAIL;
+
+    pool_mgr->num_pins++;
+    return ALLOC_OK;
+}
+
+
+alloc_status mem_pool_unpin(pool_pt pool) {
+    // get mgr from pool by casting the pointer to (pool_mgr_pt)
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // check it's pinned
+    if (!pool_mgr->num_pins) return ALLOC_FAIL;
+
+    pool_mgr->num_pins--;
+    return ALLOC_OK;
+}
+
+
+// Moves the given allocation up over the gap right before it.
+// The two nodes swap places in the linked list.
+static void _mem_slide_alloc(pool_mgr_pt pool_mgr, node_pt node)
+{
+    node_pt gap = node->prev;
+    char *top = gap->alloc_record.mem;
+    size_t extent = _mem_node_extent(node);
+
+    // move the data (and the canary, if any), the regions may overlap
+    memmove(top, node->alloc_record.mem, extent);
+
+    // the blocks of a slab move with it
+    if (node->slab)
+    {
+        ptrdiff_t shift = top - node->alloc_record.mem;
+        for (unsigned u = 0; u < node->slab->num_blocks; ++u)
+        {
+            node->slab->records[u].alloc_record.mem += shift;
+        }
+    }
+    node->alloc_record.mem = top;
+    gap->alloc_record.mem = top + extent;
+    gap->dirty = gap->alloc_record.size; // the data moved out of it
+
+    // update linked list: ... gap, node ... becomes ... node, gap ...
+    node->prev = gap->prev;
+    if (gap->prev)
+    {
+        gap->prev->next = node;
+    }
+    else
+    {
+        pool_mgr->head = node;
+    }
+    gap->next = node->next;
+    if (node->next)
+    {
+        node->next->prev = gap;
+    }
+    node->next = gap;
+    gap->prev = node;
+}
+
+
+void mem_inspect_pool(pool_pt pool,
+                      pool_segment_pt *segments,
+                      unsigned *num_segments) {
+
+    // get the mgr from the pool
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a boundary-tag pool has a segment per allocation and per gap
+    unsigned num_segs = pool_mgr->layout == LAYOUT_BOUNDARY_TAG ?
+        pool->num_allocs + pool->num_gaps : pool_mgr->used_nodes;
+
+    // allocate the segments array with size == used_nodes
+    pool_segment_pt segs = 
+        (pool_segment_pt)calloc(num_segs, sizeof(pool_segment_t));
+
+    // check successful
+    if (!segs) return;
+
+    // a boundary-tag pool is walked block by block
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        pool_cursor_t cursor = { NULL, 0 };
+        *num_segments = mem_inspect_pool_chunk(pool, segs, num_segs, &cursor);
+        *segments = segs;
+        return;
+    }
+
+    // loop through the node heap and the segments array
+    //    for each node, write the size and allocated in the segment
+    node_pt node = pool_mgr->head;
+    int next = 0;
+    for (; node; node = node->next)
+    {
+        segs[next].size = _mem_node_extent(node);
+        segs[next].allocated = node->allocated;
+        ++next;
+    }
+    *num_segments = pool_mgr->used_nodes;
+    *segments = segs;
+}
+
+
+void mem_pool_walk(pool_pt pool, pool_walk_fn fn, void *ctx) {
+    // get the mgr from the pool
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // report the segments one by one, in order, until told to stop
+    pool_segment_t seg;
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        char *end = _mem_tag_end(pool_mgr);
+        char *block = pool->mem;
+        for (; block < end; block += seg.size)
+        {
+            seg.size = _mem_tag_block_size((alloc_pt) block);
+            seg.allocated = ((alloc_pt) block)->mem != NULL;
+            if (fn(&seg, ctx)) break;
+        }
+        return;
+    }
+    for (node_pt node = pool_mgr->head; node; node = node->next)
+    {
+        seg.size = _mem_node_extent(node);
+        seg.allocated = node->allocated;
+        if (fn(&seg, ctx)) break;
+    }
+}
+
+
+unsigned mem_inspect_pool_chunk(pool_pt pool,
+                                pool_segment_pt segments,
+                                unsigned max_segments,
+                                pool_cursor_pt cursor) {
+    // get the mgr from the pool
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
 
-        // update node-to-delete as unused
-        node_to_delete->used = 0;
-        node_to_delete->alloc_record.size = 0;
-        node_to_delete->alloc_record.mem = NULL;
+    // a boundary-tag pool is walked block by block, up to its end
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        char *end = _mem_tag_end(pool_mgr);
+        char *block = cursor->started ? (char *) cursor->next : pool->mem;
+        unsigned next = 0;
+        for (; block && next < max_segments; ++next)
+        {
+            segments[next].size = _mem_tag_block_size((alloc_pt) block);
+            segments[next].allocated = ((alloc_pt) block)->mem != NULL;
+            block += segments[next].size;
+            if (block >= end) block = NULL;
+        }
+        cursor->next = block;
+        cursor->started = 1;
+        return next;
+    }
 
-        // update metadata (used_nodes)
-        pool_mgr->used_nodes--;
+    // a fresh cursor starts at the top of the pool
+    node_pt node = cursor->started ?
+        (node_pt) cursor->next : pool_mgr->head;
 
-        // update linked list
-        if (node_to_delete->next)
+    // fill in as many segments as fit, in order
+    unsigned next = 0;
+    for (; node && next < max_segments; node = node->next)
+    {
+        segments[next].size = _mem_node_extent(node);
+        segments[next].allocated = node->allocated;
+        ++next;
+    }
+
+    // remember where to pick up
+    cursor->next = node;
+    cursor->started = 1;
+    return next;
+}
+
+
+alloc_status mem_pool_validate(pool_pt pool) {
+    // get the mgr from the pool
+    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+
+    // a boundary-tag pool is checked block by block
+    if (pool_mgr->layout == LAYOUT_BOUNDARY_TAG)
+    {
+        return _mem_validate_tagged(pool_mgr);
+    }
+
+    // the counts of the pool are counted again, on the stack
+    pool_t counted = { 0 };
+    size_t slab_unused = 0;
+
+    // one walk down the list: the segments follow each other from the
+    // top of the pool to its end, every gap in the gap index is in the
+    // free list in address order, and no two of them are adjacent
+    // note: a deferred node is a gap that is in neither yet
+    char *mem = pool->mem;
+    node_pt prev = NULL, free_prev = NULL;
+    unsigned num_nodes = 0, num_deferred = 0, prev_gap = 0;
+    for (node_pt node = pool_mgr->head; node; node = node->next)
+    {
+        if (++num_nodes > pool_mgr->used_nodes) return ALLOC_FAIL;
+        if (node->used != 1 || node->prev != prev ||
+            node->alloc_record.mem != mem || !_mem_node_extent(node)) return ALLOC_FAIL;
+        mem += _mem_node_extent(node);
+        prev = node;
+
+        if (node->allocated)
         {
-            previous->next = node_to_delete->next;
-            node_to_delete->next->prev = previous;
+            if (node->deferred || *_mem_fit_size(pool_mgr, node)) return ALLOC_FAIL;
+            prev_gap = 0;
+#ifdef MEM_POOL_HARDENED
+            if (node->guarded && !_mem_guard_intact(node))
+            {
+                MEM_FAULT(pool_mgr, &node->alloc_record, FAULT_OVERRUN);
+                return ALLOC_FAIL;
+            }
+#endif
+            // a slab counts its blocks, not itself
+            if (node->slab)
+            {
+                size_t slab_used = counted.alloc_size + counted.internal_waste;
+                if (_mem_validate_slab(pool_mgr, node, &counted.num_allocs,
+                                       &counted.alloc_size,
+                                       &counted.internal_waste) == ALLOC_FAIL)
+                    return ALLOC_FAIL;
+                slab_unused += _mem_node_extent(node) -
+                               (counted.alloc_size + counted.internal_waste - slab_used);
+                continue;
+            }
+            counted.num_allocs++;
+            counted.alloc_size += node->alloc_record.size;
+            counted.internal_waste += node->waste;
+            continue;
         }
-        else
+
+        if (node->deferred)
         {
-            previous->next = NULL;
+            if (*_mem_fit_size(pool_mgr, node)) return ALLOC_FAIL;
+            num_deferred++;
+            prev_gap = 0;
+            continue;
         }
-        node_to_delete->next = NULL;
-        node_to_delete->prev = NULL;
 
-        // change the node to add to the previous node!
-        node_to_delete = previous;
+        if (prev_gap || node->free_prev != free_prev ||
+            (free_prev ? free_prev->free_next : pool_mgr->free_head) != node ||
+            *_mem_fit_size(pool_mgr, node) != node->alloc_record.size) return ALLOC_FAIL;
+        free_prev = node;
+        prev_gap = 1;
+        counted.num_gaps++;
+        if (node->alloc_record.size > counted.largest_gap)
+        {
+            counted.largest_gap = node->alloc_record.size;
+        }
+        _mem_count_gap(&counted, node->alloc_record.size, 1);
     }
 
-    // add the resulting node to the gap index
-    _mem_add_to_gap_ix(pool_mgr,
-                       node_to_delete->alloc_record.size,
-                       node_to_delete);
+    if (mem != pool->mem + pool->total_size ||
+        num_nodes != pool_mgr->used_nodes ||
+        (free_prev ? free_prev->free_next : pool_mgr->free_head) != NULL ||
+        num_deferred != pool_mgr->num_quick) return ALLOC_FAIL;
+
+    // the gap index holds the gaps (and only those), sorted, so none twice
+    if (counted.num_gaps != pool->num_gaps) return ALLOC_FAIL;
+    for (unsigned u = 0; u < pool->num_gaps; ++u)
+    {
+        gap_pt gap = &pool_mgr->gap_ix[u];
+        if (gap->node->used != 1 || gap->node->allocated || gap->node->deferred ||
+            gap->size != gap->node->alloc_record.size ||
+            (u && _mem_compare_gaps(gap - 1, gap) >= 0)) return ALLOC_FAIL;
+    }
+
+    // the direct-mapped allocations are in their table, in their slots
+    for (unsigned u = 0; u < pool_mgr->num_direct; ++u)
+    {
+        direct_record_pt record = pool_mgr->direct[u];
+        if (record->used != MEM_DIRECT_RECORD || !record->allocated ||
+            record->ix != u) return ALLOC_FAIL;
+        counted.num_allocs++;
+        counted.direct_size += record->alloc_record.size;
+    }
+
+    // and the counts of the pool agree with all that
+    if (counted.num_allocs != pool->num_allocs ||
+        counted.alloc_size != pool->alloc_size ||
+        counted.internal_waste != pool->internal_waste ||
+        counted.direct_size != pool->direct_size ||
+        counted.largest_gap != pool->largest_gap ||
+        slab_unused != pool_mgr->slab_unused ||
+        memcmp(counted.gap_hist, pool->gap_hist, sizeof(counted.gap_hist)))
+        return ALLOC_FAIL;
+
+    // and so do the structures of the policy, if any
+    if (pool_mgr->summary.max && _mem_validate_summary(pool_mgr) == ALLOC_FAIL)
+        return ALLOC_FAIL;
+    if (pool_mgr->bins.heads && _mem_validate_bins(pool_mgr) == ALLOC_FAIL)
+        return ALLOC_FAIL;
+    if (pool_mgr->rover &&
+        (pool_mgr->rover->used != 1 || pool_mgr->rover->allocated ||
+         pool_mgr->rover->deferred)) return ALLOC_FAIL;
 
     return ALLOC_OK;
 }
 
 
-void mem_inspect_pool(pool_pt pool,
-                      pool_segment_pt *segments,
-                      unsigned *num_segments) {
+// Checks the blocks of a slab against its records and its free list, and
+// adds its allocated blocks to the counts.
+static alloc_status _mem_validate_slab(pool_mgr_pt pool_mgr,
+                                       node_pt node,
+                                       unsigned *num_allocs,
+                                       size_t *alloc_size,
+                                       size_t *internal_waste)
+{
+    slab_pt slab = node->slab;
+    size_t block_size = (slab->size_class + 1) * MEM_SLAB_CLASS_SIZE;
+    if (slab->node != node || slab->size_class >= MEM_SLAB_CLASSES ||
+        slab->num_free > slab->num_blocks ||
+        slab->num_blocks * block_size > node->alloc_record.size) return ALLOC_FAIL;
+
+    // a slab is on the list of its class if, and only if, it has free blocks
+    unsigned listed = slab->prev || pool_mgr->slabs[slab->size_class] == slab;
+    if (listed != (slab->num_free != 0)) return ALLOC_FAIL;
+
+    unsigned num_free = 0;
+    for (unsigned u = 0; u < slab->num_blocks; ++u)
+    {
+        slab_record_pt record = &slab->records[u];
+        if (record->used != MEM_SLAB_RECORD || record->ix != u ||
+            record->alloc_record.mem != node->alloc_record.mem + u * block_size)
+            return ALLOC_FAIL;
+        if (!record->allocated)
+        {
+            num_free++;
+            continue;
+        }
+        if (!record->alloc_record.size || record->alloc_record.size > block_size)
+            return ALLOC_FAIL;
+        (*num_allocs)++;
+        *alloc_size += record->alloc_record.size;
+        *internal_waste += block_size - record->alloc_record.size;
+    }
 
-    // get the mgr from the pool
-    pool_mgr_pt pool_mgr = (pool_mgr_pt) pool;
+    // the free list has the free blocks, each once (it can't be longer)
+    unsigned free_slot = slab->free_head, num_listed = 0;
+    for (; num_listed < num_free; ++num_listed)
+    {
+        if (free_slot >= slab->num_blocks ||
+            slab->records[free_slot].allocated) return ALLOC_FAIL;
+        free_slot = (unsigned) slab->records[free_slot].alloc_record.size;
+    }
+    return num_free == slab->num_free ? ALLOC_OK : ALLOC_FAIL;
+}
 
-    // allocate the segments array with size == used_nodes
-    pool_segment_pt segs = 
-        (pool_segment_pt)calloc(pool_mgr->used_nodes, sizeof(pool_segment_t));
 
-    // check successful
-    if (!segs) return;
+// Checks the gap summary against the free list: each region has its
+// largest gap and its lowest gap, and each inner entry the larger child.
+static alloc_status _mem_validate_summary(pool_mgr_pt pool_mgr)
+{
+    gap_summary_pt summary = &pool_mgr->summary;
+    node_pt gap = pool_mgr->free_head;
+    for (unsigned region = 0; region < summary->num_leaves; ++region)
+    {
+        size_t max = 0;
+        node_pt first = gap && _mem_summary_region(pool_mgr, gap) == region ? gap : NULL;
+        for (; gap && _mem_summary_region(pool_mgr, gap) == region; gap = gap->free_next)
+        {
+            if (gap->alloc_record.size > max) max = gap->alloc_record.size;
+        }
+        if (summary->max[summary->num_leaves + region] != max ||
+            summary->first[region] != first) return ALLOC_FAIL;
+    }
+    for (unsigned i = summary->num_leaves - 1; i; --i)
+    {
+        size_t children = summary->max[2 * i] > summary->max[2 * i + 1]
+                          ? summary->max[2 * i] : summary->max[2 * i + 1];
+        if (summary->max[i] != children) return ALLOC_FAIL;
+    }
+    return gap ? ALLOC_FAIL : ALLOC_OK;
+}
 
-    // loop through the node heap and the segments array
-    //    for each node, write the size and allocated in the segment
-    node_pt node = pool_mgr->node_heap;
-    int next = 0;
-    for (; node; node = node->next)
+
+// Checks the size-class bins: every gap is in the list of its class, and
+// the bit of a class is set if, and only if, its list is not empty.
+static alloc_status _mem_validate_bins(pool_mgr_pt pool_mgr)
+{
+    fit_bins_pt bins = &pool_mgr->bins;
+    unsigned num_binned = 0;
+    for (unsigned c = 0; c < MEM_FIT_BIN_CLASSES; ++c)
     {
-        segs[next].size = node->alloc_record.size;
-        segs[next].allocated = node->allocated;
-        ++next;
+        unsigned bit = (bins->map[c / 64] >> (c % 64)) & 1;
+        if (bit != (bins->heads[c] != NULL)) return ALLOC_FAIL;
+
+        node_pt bin_prev = NULL;
+        for (node_pt gap = bins->heads[c]; gap; gap = gap->bin_next)
+        {
+            if (++num_binned > pool_mgr->pool.num_gaps ||
+                gap->used != 1 || gap->allocated || gap->deferred ||
+                gap->bin_prev != bin_prev ||
+                _mem_size_class(gap->alloc_record.size) != c) return ALLOC_FAIL;
+            bin_prev = gap;
+        }
     }
-    *num_segments = pool_mgr->used_nodes;
-    *segments = segs;
+    return num_binned == pool_mgr->pool.num_gaps ? ALLOC_OK : ALLOC_FAIL;
+}
+
+
+// Checks a boundary-tag pool: the blocks follow each other to the end of
+// the pool, their headers and footers agree, no two gaps are adjacent,
+// and the free list has all the gaps.
+static alloc_status _mem_validate_tagged(pool_mgr_pt pool_mgr)
+{
+    pool_pt pool = &pool_mgr->pool;
+    char *end = _mem_tag_end(pool_mgr);
+    pool_t counted = { 0 };
+
+    unsigned prev_gap = 0;
+    for (char *block = pool->mem; block < end; )
+    {
+        alloc_pt header = (alloc_pt) block;
+        if (header->mem && header->mem != (char *) (header + 1)) return ALLOC_FAIL;
+
+        // an allocation's block is at least the least one of its size, and
+        // has less than a gap after that, or it would have been split
+        size_t size = header->mem ? _mem_tag_need(header->size) : header->size;
+        if (size < MEM_TAG_MIN_BLOCK || size % MEM_TAG_ALIGN ||
+            size > (size_t) (end - block)) return ALLOC_FAIL;
+        if (header->mem)
+        {
+            size_t need = size;
+            size_t tag = *(size_t *) (block + need - sizeof(size_t));
+            size = tag & ~(size_t) 1;
+            if (tag % MEM_TAG_ALIGN != 1 || size < need || size - need >= MEM_TAG_MIN_BLOCK ||
+                size > (size_t) (end - block))
+            {
+                MEM_FAULT(pool_mgr, header, FAULT_OVERRUN);
+                return ALLOC_FAIL;
+            }
+        }
+        size_t footer = *(size_t *) (block + size - sizeof(size_t));
+        if (footer != (size | (header->mem != NULL)))
+        {
+            if (header->mem) MEM_FAULT(pool_mgr, header, FAULT_OVERRUN);
+            return ALLOC_FAIL;
+        }
+
+        if (header->mem)
+        {
+            counted.num_allocs++;
+            counted.alloc_size += header->size;
+            counted.internal_waste += size - MEM_TAG_OVERHEAD - header->size;
+            prev_gap = 0;
+        }
+        else
+        {
+            if (prev_gap) return ALLOC_FAIL;
+            counted.num_gaps++;
+            _mem_count_gap(&counted, size, 1);
+            if (size > counted.largest_gap)
+            {
+                counted.largest_gap = size;
+            }
+            prev_gap = 1;
+        }
+        block += size;
+    }
+
+    // the free list is as long as there are gaps, and only has gaps
+    unsigned num_listed = 0;
+    tag_gap_pt prev = NULL;
+    for (tag_gap_pt gap = pool_mgr->tag_free_head; gap; gap = gap->next)
+    {
+        if (++num_listed > counted.num_gaps || gap->prev != prev ||
+            (char *) gap < pool->mem || (char *) gap >= end ||
+            gap->header.mem) return ALLOC_FAIL;
+        prev = gap;
+    }
+
+    if (num_listed != counted.num_gaps ||
+        counted.num_gaps != pool->num_gaps ||
+        counted.num_allocs != pool->num_allocs ||
+        counted.alloc_size != pool->alloc_size ||
+        counted.internal_waste != pool->internal_waste ||
+        counted.largest_gap != pool->largest_gap ||
+        memcmp(counted.gap_hist, pool->gap_hist, sizeof(counted.gap_hist)))
+        return ALLOC_FAIL;
+    return ALLOC_OK;
 }
 
 
@@ -560,13 +3559,22 @@ void mem_inspect_pool(pool_pt pool,
 /***********************************/
 static alloc_status _mem_resize_pool_store() {
     // check if necessary
+    // note: only slots that were never handed out count toward the size
     float fill_factor = (float)pool_store_size / pool_store_capacity;
     if (fill_factor > MEM_POOL_STORE_FILL_FACTOR)
     {
         unsigned new_cap = pool_store_capacity * MEM_POOL_STORE_EXPAND_FACTOR;
-        pool_store = (pool_mgr_pt*)
+        pool_mgr_pt *store = (pool_mgr_pt*)
             realloc(pool_store, sizeof(pool_mgr_pt) * new_cap);
-            
+        if (!store) return ALLOC_FAIL;
+        pool_store = store;
+
+        // the free stack never holds more than the store's slots
+        unsigned *free_slots = (unsigned*)
+            realloc(pool_store_free, sizeof(unsigned) * new_cap);
+        if (!free_slots) return ALLOC_FAIL;
+        pool_store_free = free_slots;
+
         for (int i = pool_store_size; i < new_cap; ++i)
         {
             pool_store[i] = NULL;
@@ -583,28 +3591,53 @@ static alloc_status _mem_resize_node_heap(pool_mgr_pt pool_mgr) {
     if (fill_factor > MEM_NODE_HEAP_FILL_FACTOR)
     {
         unsigned new_cap = pool_mgr->total_nodes * MEM_NODE_HEAP_EXPAND_FACTOR;
-
-        pool_mgr->node_heap =
-            (node_pt) realloc(pool_mgr->node_heap, sizeof(node_t) * new_cap);
-
-        for (int i = pool_mgr->total_nodes; i < new_cap; ++i)
-        {
-            node_pt node = &pool_mgr->node_heap[i];
-            _init_node(node);
-        }
+        unsigned num_nodes = new_cap - pool_mgr->total_nodes;
+
+        // add a chunk for the new nodes, the existing ones stay put
+        node_chunk_pt node_heap = (node_chunk_pt) realloc(pool_mgr->node_heap,
+            sizeof(node_chunk_t) * (pool_mgr->num_chunks + 1));
+        if (!node_heap) return ALLOC_FAIL;
+        pool_mgr->node_heap = node_heap;
+
+        if (_mem_new_node_chunk(&node_heap[pool_mgr->num_chunks],
+                                pool_mgr->num_chunks,
+                                pool_mgr->total_nodes,
+                                num_nodes) == ALLOC_FAIL) return ALLOC_FAIL;
+        pool_mgr->num_chunks++;
         pool_mgr->total_nodes = new_cap;
+        MEM_STATS_ADD(pool_mgr, node_heap_resizes, 1);
     }
     return ALLOC_OK;
 }
 
 
-// Initialize the given node with all zeros or NULLs.
+// Returns a node that was merged away to the unused nodes.
+static void _mem_release_node(pool_mgr_pt pool_mgr, node_pt node)
+{
+    _init_node(node);
+    *_mem_fit_size(pool_mgr, node) = 0;
+    pool_mgr->used_nodes--;
+    if (node->ix < pool_mgr->unused_hint)
+    {
+        pool_mgr->unused_hint = node->ix;
+    }
+}
+
+
+// Initialize the given node with all zeros or NULLs (but its slot).
+// note: its fit size is kept up to date with the gap index
 static void _init_node(node_pt node)
 {
     node->used = 0;
     node->allocated = 0;
+    node->deferred = 0;
     node->next = NULL;
     node->prev = NULL;
+    node->free_next = NULL;
+    node->free_prev = NULL;
+    node->bin_next = NULL; // (and so the fields of an allocation, too)
+    node->bin_prev = NULL;
+    node->dirty = 0;
     node->alloc_record.size = 0;
     node->alloc_record.mem = NULL;
 }
@@ -643,14 +3676,24 @@ static alloc_status _mem_add_to_gap_ix(pool_mgr_pt pool_mgr,
     gap_pt gap = &pool_mgr->gap_ix[pool_mgr->pool.num_gaps];
     gap->size = size;
     gap->node = node;
+    *_mem_fit_size(pool_mgr, node) = size;
+    if (pool_mgr->bins.heads)
+    {
+        _mem_bin_gap(pool_mgr, node, size);
+    }
 
-    // update metadata (num_gaps)
+    // update metadata (num_gaps, gap_hist)
     pool_mgr->pool.num_gaps++;
+    _mem_count_gap(&pool_mgr->pool, size, 1);
 
     // sort the gap index (call the function)
     alloc_status status = _mem_sort_gap_ix(pool_mgr);
 
     if (status == ALLOC_FAIL) return status;
+
+    // the largest gap is always at the end of the index
+    pool_mgr->pool.largest_gap =
+        pool_mgr->gap_ix[pool_mgr->pool.num_gaps - 1].size;
     return ALLOC_OK;
 }
 
@@ -659,28 +3702,31 @@ static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
                                             size_t size,
                                             node_pt node) {
     // find the position of the node in the gap index
-    int index = -1;
-    for (int i = 0; i < pool_mgr->gap_ix_capacity; ++i)
+    int index = _mem_find_in_gap_ix(pool_mgr, node);
+    if (index < 0) return ALLOC_FAIL;
+
+    // note: the size of the entry, which callers may not pass in
+    size = pool_mgr->gap_ix[index].size;
+    *_mem_fit_size(pool_mgr, node) = 0;
+    if (pool_mgr->bins.heads)
     {
-        if (pool_mgr->gap_ix[i].node == node)
-        {
-            index = i;
-            break;
-        }
+        _mem_unbin_gap(pool_mgr, node, size);
     }
 
-    if (index < 0) return ALLOC_FAIL;
-
     // loop from there to the end of the array:
-    for (int i = index; i < pool_mgr->gap_ix_capacity - 1; ++i)
+    for (unsigned i = (unsigned) index; i + 1 < pool_mgr->pool.num_gaps; ++i)
     {
         // pull the entries (i.e. copy over) one position up
         // this effectively deletes the chosen node
         pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i + 1];
     }
+    MEM_STATS_ADD(pool_mgr, gap_ix_shifts, pool_mgr->pool.num_gaps - index - 1);
 
-    // update metadata (num_gaps)
+    // update metadata (num_gaps, gap_hist, largest_gap)
     pool_mgr->pool.num_gaps--;
+    _mem_count_gap(&pool_mgr->pool, size, -1);
+    pool_mgr->pool.largest_gap = pool_mgr->pool.num_gaps ?
+        pool_mgr->gap_ix[pool_mgr->pool.num_gaps - 1].size : 0;
 
     // zero out the element at position num_gaps!
     gap_pt last = &pool_mgr->gap_ix[pool_mgr->pool.num_gaps];
@@ -690,6 +3736,293 @@ static alloc_status _mem_remove_from_gap_ix(pool_mgr_pt pool_mgr,
 }
 
 
+// Refills the gap index from the gap nodes in the linked list and sorts it
+// in a single pass, instead of one add/remove per changed gap.
+// Expands the gap index to hold the given number of gaps, if necessary.
+// note: called before gaps are merged or moved, with as many as there
+// can be after, so that the rebuild that follows can't fail halfway
+static alloc_status _mem_reserve_gap_ix(pool_mgr_pt pool_mgr, unsigned num_gaps)
+{
+    unsigned new_cap = pool_mgr->gap_ix_capacity;
+    while ((float) num_gaps / new_cap > MEM_GAP_IX_FILL_FACTOR)
+    {
+        new_cap *= MEM_GAP_IX_EXPAND_FACTOR;
+    }
+    if (new_cap != pool_mgr->gap_ix_capacity)
+    {
+        gap_pt gap_ix =
+            (gap_pt) realloc(pool_mgr->gap_ix, sizeof(gap_t) * new_cap);
+        if (!gap_ix) return ALLOC_FAIL;
+        pool_mgr->gap_ix = gap_ix;
+        pool_mgr->gap_ix_capacity = new_cap;
+    }
+    return ALLOC_OK;
+}
+
+
+static alloc_status _mem_rebuild_gap_ix(pool_mgr_pt pool_mgr) {
+    // count the gaps
+    unsigned num_gaps = 0;
+    node_pt node = pool_mgr->head;
+    for (; node; node = node->next)
+    {
+        if (!node->allocated) ++num_gaps;
+    }
+
+    // expand the gap index, if necessary (it was reserved, if the gaps
+    // have changed already)
+    if (_mem_reserve_gap_ix(pool_mgr, num_gaps) == ALLOC_FAIL) return ALLOC_FAIL;
+
+    // fill in the entries (fit sizes and free list) and zero out the rest
+    for (unsigned c = 0; c < pool_mgr->num_chunks; ++c)
+    {
+        memset(pool_mgr->node_heap[c].fit_sizes, 0,
+               sizeof(size_t) * pool_mgr->node_heap[c].num_nodes);
+    }
+    unsigned next = 0;
+    node_pt free_prev = NULL;
+    pool_mgr->free_head = NULL;
+    for (node = pool_mgr->head; node; node = node->next)
+    {
+        if (node->allocated) continue;
+        pool_mgr->gap_ix[next].size = node->alloc_record.size;
+        pool_mgr->gap_ix[next].node = node;
+        *_mem_fit_size(pool_mgr, node) = node->alloc_record.size;
+        node->free_prev = free_prev;
+        node->free_next = NULL;
+        if (free_prev)
+        {
+            free_prev->free_next = node;
+        }
+        else
+        {
+            pool_mgr->free_head = node;
+        }
+        free_prev = node;
+        ++next;
+    }
+
+    // the gaps have moved or merged, summarize and bin them again
+    if (pool_mgr->summary.max)
+    {
+        _mem_summary_rebuild(pool_mgr);
+    }
+    if (pool_mgr->bins.heads)
+    {
+        memset(pool_mgr->bins.heads, 0, MEM_FIT_BIN_CLASSES * sizeof(node_pt));
+        memset(pool_mgr->bins.map, 0, MEM_FIT_BIN_CLASSES / 64 * sizeof(uint64_t));
+        for (node = pool_mgr->free_head; node; node = node->free_next)
+        {
+            _mem_bin_gap(pool_mgr, node, node->alloc_record.size);
+        }
+    }
+
+    // a rover that was merged away starts over from the top
+    if (pool_mgr->rover &&
+        (!pool_mgr->rover->used || pool_mgr->rover->allocated))
+    {
+        pool_mgr->rover = NULL;
+    }
+    for (unsigned u = next; u < pool_mgr->gap_ix_capacity; ++u)
+    {
+        pool_mgr->gap_ix[u].size = 0;
+        pool_mgr->gap_ix[u].node = NULL;
+    }
+    pool_mgr->pool.num_gaps = num_gaps;
+
+    // same order as _mem_sort_gap_ix: by size, then by address
+    qsort(pool_mgr->gap_ix, num_gaps, sizeof(gap_t), _mem_compare_gaps);
+
+    // recount the gap metadata from scratch
+    memset(pool_mgr->pool.gap_hist, 0, sizeof(pool_mgr->pool.gap_hist));
+    for (unsigned u = 0; u < num_gaps; ++u)
+    {
+        _mem_count_gap(&pool_mgr->pool, pool_mgr->gap_ix[u].size, 1);
+    }
+    pool_mgr->pool.largest_gap =
+        num_gaps ? pool_mgr->gap_ix[num_gaps - 1].size : 0;
+
+    return ALLOC_OK;
+}
+
+
+#if defined(MEM_POOL_STATS) || defined(MEM_POOL_TRACE)
+// Monotonic time in ns.
+static unsigned long _mem_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+#endif
+
+
+#ifdef MEM_POOL_STATS
+
+// Counts a latency in its histogram bucket. Values below 4 get their own
+// bucket, above that each power of 2 is split into 4 linear sub-buckets.
+static void _mem_stats_record(unsigned long *hist, unsigned long ns)
+{
+    unsigned bucket = (unsigned) ns;
+    if (ns >= 4)
+    {
+        unsigned msb = 0;
+        for (unsigned long v = ns; v >>= 1; ) ++msb;
+        bucket = (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+    }
+    if (bucket >= MEM_LATENCY_BUCKETS)
+    {
+        bucket = MEM_LATENCY_BUCKETS - 1;
+    }
+    hist[bucket]++;
+}
+#endif
+
+
+#ifdef MEM_POOL_TRACE
+// Appends a record of a call to the trace, if one is being recorded.
+static void _mem_trace_record(mem_trace_op op,
+                              const void *pool,
+                              const void *alloc,
+                              size_t size,
+                              unsigned arg)
+{
+    if (!trace_file) return;
+
+    mem_trace_record_t record;
+    record.time_ns = _mem_now_ns() - trace_start_ns;
+    record.pool = (uintptr_t) pool;
+    record.alloc = (uintptr_t) alloc;
+    record.size = size;
+    record.op = op;
+    record.arg = arg;
+    fwrite(&record, sizeof(record), 1, trace_file);
+}
+#endif
+
+
+// Adds (delta 1) or removes (delta -1) a gap of the given size
+// to/from the gap size histogram of the pool.
+static void _mem_count_gap(pool_pt pool, size_t size, int delta)
+{
+    unsigned bucket = 0;
+    while (size >>= 1)
+    {
+        ++bucket;
+    }
+    if (bucket >= MEM_GAP_HIST_BUCKETS)
+    {
+        bucket = MEM_GAP_HIST_BUCKETS - 1;
+    }
+    pool->gap_hist[bucket] += delta;
+}
+
+
+static int _mem_compare_gaps(const void *a, const void *b) {
+    const gap_t *gap_a = (const gap_t *) a;
+    const gap_t *gap_b = (const gap_t *) b;
+
+    if (gap_a->size != gap_b->size)
+    {
+        return (gap_a->size < gap_b->size) ? -1 : 1;
+    }
+    if (gap_a->node->alloc_record.mem != gap_b->node->alloc_record.mem)
+    {
+        return (gap_a->node->alloc_record.mem < gap_b->node->alloc_record.mem)
+               ? -1 : 1;
+    }
+    return 0;
+}
+
+
+// Finds the position of the given gap node in the gap index, or -1.
+static int _mem_find_in_gap_ix(pool_mgr_pt pool_mgr, node_pt node) {
+    // the index is sorted by size, then address, so binary search it
+    gap_t key = { node->alloc_record.size, node };
+    unsigned lo = 0, hi = pool_mgr->pool.num_gaps;
+    while (lo < hi)
+    {
+        unsigned mid = lo + (hi - lo) / 2;
+        if (_mem_compare_gaps(&pool_mgr->gap_ix[mid], &key) < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+        MEM_STATS_ADD(pool_mgr, gap_ix_scans, 1);
+    }
+    if (lo < pool_mgr->pool.num_gaps && pool_mgr->gap_ix[lo].node == node)
+    {
+        return (int) lo;
+    }
+
+    // not where its size puts it, fall back to a linear search
+    for (unsigned i = 0; i < pool_mgr->pool.num_gaps; ++i)
+    {
+        if (pool_mgr->gap_ix[i].node == node)
+        {
+            MEM_STATS_ADD(pool_mgr, gap_ix_scans, i + 1);
+            return (int) i;
+        }
+    }
+    MEM_STATS_ADD(pool_mgr, gap_ix_scans, pool_mgr->pool.num_gaps);
+    return -1;
+}
+
+
+static unsigned _mem_scan_fit_scalar(const size_t *sizes,
+                                     unsigned n,
+                                     size_t min_size) {
+    unsigned i = 0;
+    while (i < n && sizes[i] < min_size) ++i;
+    return i;
+}
+
+
+#ifdef MEM_SCAN_X86
+// note: sizes are compared as signed 64-bit integers (the only
+// comparison there is), which is fine for any size below 2^63
+__attribute__((target("sse4.2")))
+static unsigned _mem_scan_fit_sse42(const size_t *sizes,
+                                    unsigned n,
+                                    size_t min_size) {
+    // sizes[i] >= min_size <=> sizes[i] > min_size - 1, 4 at a time
+    const __m128i bound = _mm_set1_epi64x((long long) (min_size - 1));
+    unsigned i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) &sizes[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *) &sizes[i + 2]);
+        __m128i fit = _mm_or_si128(_mm_cmpgt_epi64(a, bound),
+                                   _mm_cmpgt_epi64(b, bound));
+        if (!_mm_testz_si128(fit, fit)) break;
+    }
+    return i + _mem_scan_fit_scalar(&sizes[i], n - i, min_size);
+}
+
+
+__attribute__((target("avx2")))
+static unsigned _mem_scan_fit_avx2(const size_t *sizes,
+                                   unsigned n,
+                                   size_t min_size) {
+    // same as above, 8 at a time
+    const __m256i bound = _mm256_set1_epi64x((long long) (min_size - 1));
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *) &sizes[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *) &sizes[i + 4]);
+        __m256i fit = _mm256_or_si256(_mm256_cmpgt_epi64(a, bound),
+                                      _mm256_cmpgt_epi64(b, bound));
+        if (!_mm256_testz_si256(fit, fit)) break;
+    }
+    return i + _mem_scan_fit_scalar(&sizes[i], n - i, min_size);
+}
+#endif
+
+
 // note: only called by _mem_add_to_gap_ix, which appends a single entry
 static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
     // the new entry is at the end, so "bubble it up"
@@ -703,6 +4036,7 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
             gap_t temp = pool_mgr->gap_ix[i];
             pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i - 1];
             pool_mgr->gap_ix[i - 1] = temp;
+            MEM_STATS_ADD(pool_mgr, gap_ix_shifts, 1);
         }
         else if(pool_mgr->gap_ix[i].size == pool_mgr->gap_ix[i - 1].size)
         {
@@ -712,8 +4046,17 @@ static alloc_status _mem_sort_gap_ix(pool_mgr_pt pool_mgr) {
                 gap_t temp = pool_mgr->gap_ix[i];
                 pool_mgr->gap_ix[i] = pool_mgr->gap_ix[i - 1];
                 pool_mgr->gap_ix[i - 1] = temp;
+                MEM_STATS_ADD(pool_mgr, gap_ix_shifts, 1);
+            }
+            else
+            {
+                break; // in place, the rest is still sorted
             }
         }
+        else
+        {
+            break; // in place, the rest is still sorted
+        }
     }
     return ALLOC_OK;
 }
@@ -7,17 +7,41 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* constants */
+
+#define MEM_GAP_HIST_BUCKETS 32 // gap_hist[k] counts gaps of [2^k, 2^(k+1))
+#define MEM_LATENCY_BUCKETS 128 // 4 linear sub-buckets per power of 2 (in ns)
+
 /* type declarations */
 
-typedef enum _alloc_policy { FIRST_FIT, BEST_FIT } alloc_policy;
+// FIRST_FIT takes the first gap found in the node heap, ADDRESS_FIRST_FIT
+// the one lowest in the pool, NEXT_FIT the next one after the last allocation,
+// GOOD_FIT any one from the smallest size class sure to fit
+typedef enum _alloc_policy { FIRST_FIT, BEST_FIT, NEXT_FIT, ADDRESS_FIRST_FIT, GOOD_FIT } alloc_policy;
+
+// LAYOUT_NODE_HEAP keeps the metadata of the segments in a node heap apart
+// from the pool, LAYOUT_BOUNDARY_TAG in a header and footer around each
+// block, in the pool (FIRST_FIT and BEST_FIT only)
+typedef enum _pool_layout { LAYOUT_NODE_HEAP, LAYOUT_BOUNDARY_TAG } pool_layout;
+
+// the instructions the first-fit scan uses, SCAN_AUTO picks the widest
+typedef enum _scan_kernel { SCAN_AUTO, SCAN_SCALAR, SCAN_SSE42, SCAN_AVX2 } scan_kernel;
 
 typedef struct _pool {
     char *mem;
     alloc_policy policy;
     size_t total_size;
-    size_t alloc_size;
+    size_t alloc_size; // bytes requested by the allocations in mem
     unsigned num_allocs;
     unsigned num_gaps;
+    size_t largest_gap;
+    size_t internal_waste; // bytes allocated beyond the requested sizes
+    size_t direct_size; // bytes in direct-mapped allocations, not in mem
+    unsigned gap_hist[MEM_GAP_HIST_BUCKETS]; // last bucket takes the rest
 } pool_t, *pool_pt;
 
 typedef struct _alloc {
@@ -30,6 +54,25 @@ typedef struct _pool_segment {
     unsigned long allocated; // 1-allocation, 0-gap (note: 8 bytes)
 } pool_segment_t, *pool_segment_pt;
 
+// return nonzero to stop the walk
+typedef int (*pool_walk_fn)(const pool_segment_t *segment, void *ctx);
+
+typedef struct _pool_cursor {
+    const void *next; // the node (or block) of the next segment to report
+    unsigned started; // zero the cursor to start from the top of the pool
+} pool_cursor_t, *pool_cursor_pt;
+
+typedef struct _pool_stats {
+    unsigned long alloc_ns_hist[MEM_LATENCY_BUCKETS]; // mem_new_alloc
+    unsigned long del_ns_hist[MEM_LATENCY_BUCKETS];   // mem_del_alloc
+    unsigned long gap_ix_scans;  // gap index entries looked at
+    unsigned long gap_ix_shifts; // gap index entries moved
+    unsigned long node_heap_resizes;
+    unsigned long failed_allocs;
+    unsigned long zeroed_bytes;       // by mem_new_alloc_zeroed
+    unsigned long zero_skipped_bytes; // known to be zero already
+} pool_stats_t, *pool_stats_pt;
+
 typedef enum _alloc_status {
     ALLOC_OK,
     ALLOC_FAIL,
@@ -37,6 +80,13 @@ typedef enum _alloc_status {
     ALLOC_NOT_FREED
 } alloc_status;
 
+// what a hardened build found wrong with an allocation: FAULT_BAD_FREE a
+// deallocation of something that isn't a live allocation of the pool (a
+// repeated one, a gap), FAULT_OVERRUN a write past the end of one
+typedef enum _mem_fault { FAULT_BAD_FREE, FAULT_OVERRUN } mem_fault;
+
+typedef void (*mem_fault_fn)(pool_pt pool, alloc_pt alloc, mem_fault fault);
+
 /* function declarations */
 
 alloc_status
@@ -48,16 +98,116 @@ mem_free();
 pool_pt
 mem_pool_open(size_t size, alloc_policy policy);
 
+pool_pt
+mem_pool_open_layout(size_t size, alloc_policy policy, pool_layout layout);
+
 alloc_status
 mem_pool_close(pool_pt pool);
 
 alloc_pt
 mem_new_alloc(pool_pt pool, size_t size);
 
+// mem_new_alloc() for a pool of one policy, without dispatching on it
+// note: only the fit search is specialized; the layout and the small,
+//       quick and direct tiers are still checked at run time
+alloc_pt
+mem_new_alloc_first_fit(pool_pt pool, size_t size);
+
+alloc_pt
+mem_new_alloc_best_fit(pool_pt pool, size_t size);
+
+alloc_pt
+mem_new_alloc_next_fit(pool_pt pool, size_t size);
+
+alloc_pt
+mem_new_alloc_address_first_fit(pool_pt pool, size_t size);
+
+alloc_pt
+mem_new_alloc_good_fit(pool_pt pool, size_t size);
+
+alloc_pt
+mem_new_alloc_zeroed(pool_pt pool, size_t size);
+
 alloc_status
 mem_del_alloc(pool_pt pool, alloc_pt alloc);
 
+alloc_status
+mem_del_alloc_batch(pool_pt pool, alloc_pt *allocs, unsigned num_allocs);
+
+alloc_status
+mem_pool_set_deferred_coalescing(pool_pt pool, unsigned budget);
+
+alloc_status
+mem_pool_set_max_waste(pool_pt pool, unsigned percent);
+
+size_t
+mem_pool_trim(pool_pt pool);
+
+alloc_status
+mem_pool_set_small_objects(pool_pt pool, size_t max_size);
+
+alloc_status
+mem_pool_set_direct_map(pool_pt pool, size_t min_size);
+
+float
+mem_pool_ext_frag(pool_pt pool);
+
+alloc_status
+mem_trace_start(const char *path);
+
+alloc_status
+mem_trace_stop();
+
+alloc_status
+mem_pool_stats(pool_pt pool, pool_stats_pt stats);
+
+alloc_status
+mem_set_fault_handler(mem_fault_fn fn);
+
+alloc_status
+mem_pool_set_guard_sample(pool_pt pool, unsigned period);
+
+unsigned long
+mem_latency_percentile(const unsigned long *hist, double percentile);
+
+alloc_status
+mem_set_scan_kernel(scan_kernel kernel);
+
+scan_kernel
+mem_scan_kernel();
+
+alloc_status
+mem_pool_compact(pool_pt pool);
+
+size_t
+mem_pool_compact_step(pool_pt pool, size_t max_bytes);
+
+// holds off compaction while the caller uses allocations by address
+// note: counted, every pin needs an unpin
+alloc_status
+mem_pool_pin(pool_pt pool);
+
+alloc_status
+mem_pool_unpin(pool_pt pool);
+
 void
 mem_inspect_pool(pool_pt pool, pool_segment_pt *segments, unsigned *num_segments);
 
+void
+mem_pool_walk(pool_pt pool, pool_walk_fn fn, void *ctx);
+
+unsigned
+mem_inspect_pool_chunk(pool_pt pool,
+                       pool_segment_pt segments,
+                       unsigned max_segments,
+                       pool_cursor_pt cursor);
+
+// checks the metadata of the pool against itself, in one pass over it
+alloc_status
+mem_pool_validate(pool_pt pool);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
 #endif //DENVER_OS_PA_C_MEM_POOL_H
@@ -0,0 +1,514 @@
+/*
+ * C++ layer over the mem_pool library:
+ *   - mem_pool::pool_resource, a std::pmr::memory_resource
+ *   - mem_pool::pool_allocator<T>, a (stateful) standard allocator
+ *   - mem_pool::Pool<Policy>, a pool of a policy fixed at compile time
+ *   - mem_pool::Allocation and mem_pool::Handle<T>, move-only owners of
+ *     an allocation and of an object constructed in one
+ *
+ * Only Pool owns its pool. The pool has to stay open as long as anything
+ * allocated through the others is live.
+ *
+ * Compaction moves allocations, and only updates their records, so the
+ * pool is pinned (see mem_pool_pin()) for as long as anything is live
+ * that is used through its address: a block of pool_resource or of
+ * pool_allocator, an object of a Handle, a slab of Pool<Slab<Size>>.
+ * Allocation and Pool<Policy> go through the record, and don't pin it.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_POOL_HPP
+#define DENVER_OS_PA_C_MEM_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring> // for std::memcpy()
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "mem_pool.h"
+
+namespace mem_pool {
+
+namespace detail {
+
+// The pool does not align allocations, so every block is allocated with
+// room to align it, and with its allocation record stored right before
+// the aligned address, for the deallocation to find it. The block is
+// used by address, so the pool stays pinned until it's deallocated.
+inline void *allocate(pool_pt pool, std::size_t bytes, std::size_t alignment)
+{
+    if (alignment < alignof(alloc_pt)) alignment = alignof(alloc_pt);
+
+    std::size_t extra = sizeof(alloc_pt) + alignment - 1;
+    if (bytes > SIZE_MAX - extra) throw std::bad_alloc();
+
+    alloc_pt alloc = mem_new_alloc(pool, bytes + extra);
+    if (!alloc) throw std::bad_alloc();
+    if (mem_pool_pin(pool) != ALLOC_OK)
+    {
+        mem_del_alloc(pool, alloc);
+        throw std::bad_alloc();
+    }
+
+    std::uintptr_t addr =
+        reinterpret_cast<std::uintptr_t>(alloc->mem) + sizeof(alloc_pt);
+    addr = (addr + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+
+    void *p = reinterpret_cast<void *>(addr);
+    std::memcpy(static_cast<char *>(p) - sizeof(alloc_pt), &alloc, sizeof(alloc_pt));
+    return p;
+}
+
+inline void deallocate(pool_pt pool, void *p) noexcept
+{
+    alloc_pt alloc;
+    std::memcpy(&alloc, static_cast<char *>(p) - sizeof(alloc_pt), sizeof(alloc_pt));
+    if (mem_del_alloc(pool, alloc) == ALLOC_OK) mem_pool_unpin(pool);
+}
+
+} // namespace detail
+
+
+// A polymorphic memory resource backed by a pool.
+// note: two resources are equal if they allocate from the same pool
+class pool_resource : public std::pmr::memory_resource {
+public:
+    explicit pool_resource(pool_pt pool) noexcept : pool_(pool) {}
+
+    pool_pt pool() const noexcept { return pool_; }
+
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return detail::allocate(pool_, bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t) override
+    {
+        detail::deallocate(pool_, p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const pool_resource *that = dynamic_cast<const pool_resource *>(&other);
+        return that && that->pool_ == pool_;
+    }
+
+private:
+    pool_pt pool_;
+};
+
+
+// A standard allocator backed by a pool. Copies (and rebinds) allocate
+// from the same pool, and are moved along with the container.
+template <class T>
+class pool_allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit pool_allocator(pool_pt pool) noexcept : pool_(pool) {}
+
+    template <class U>
+    pool_allocator(const pool_allocator<U> &other) noexcept : pool_(other.pool()) {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > SIZE_MAX / sizeof(T)) throw std::bad_array_new_length();
+        return static_cast<T *>(detail::allocate(pool_, n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t) noexcept
+    {
+        detail::deallocate(pool_, p);
+    }
+
+    pool_pt pool() const noexcept { return pool_; }
+
+private:
+    pool_pt pool_;
+};
+
+template <class T, class U>
+bool operator==(const pool_allocator<T> &a, const pool_allocator<U> &b) noexcept
+{
+    return a.pool() == b.pool();
+}
+
+template <class T, class U>
+bool operator!=(const pool_allocator<T> &a, const pool_allocator<U> &b) noexcept
+{
+    return a.pool() != b.pool();
+}
+
+
+// The allocation policies, for Pool<Policy>.
+// note: each one calls the out-of-line mem_new_alloc_* of its policy,
+//       which skips the policy dispatch but not the layout and tier
+//       checks; deallocation is mem_del_alloc() for all of them
+struct FirstFit {
+    static constexpr alloc_policy policy = FIRST_FIT;
+    static alloc_pt allocate(pool_pt pool, std::size_t size) noexcept
+    {
+        return mem_new_alloc_first_fit(pool, size);
+    }
+};
+
+struct BestFit {
+    static constexpr alloc_policy policy = BEST_FIT;
+    static alloc_pt allocate(pool_pt pool, std::size_t size) noexcept
+    {
+        return mem_new_alloc_best_fit(pool, size);
+    }
+};
+
+struct NextFit {
+    static constexpr alloc_policy policy = NEXT_FIT;
+    static alloc_pt allocate(pool_pt pool, std::size_t size) noexcept
+    {
+        return mem_new_alloc_next_fit(pool, size);
+    }
+};
+
+struct AddressFirstFit {
+    static constexpr alloc_policy policy = ADDRESS_FIRST_FIT;
+    static alloc_pt allocate(pool_pt pool, std::size_t size) noexcept
+    {
+        return mem_new_alloc_address_first_fit(pool, size);
+    }
+};
+
+struct GoodFit {
+    static constexpr alloc_policy policy = GOOD_FIT;
+    static alloc_pt allocate(pool_pt pool, std::size_t size) noexcept
+    {
+        return mem_new_alloc_good_fit(pool, size);
+    }
+};
+
+// Blocks of a single size of at least Size bytes, see Pool<Slab<Size>>.
+template <std::size_t Size>
+struct Slab {
+    static_assert(Size > 0, "a slab block can't be empty");
+
+    static constexpr std::size_t alignment = alignof(std::max_align_t);
+    static constexpr std::size_t block_size =
+        ((Size < sizeof(void *) ? sizeof(void *) : Size) + alignment - 1)
+        & ~(alignment - 1);
+    static constexpr std::size_t blocks_per_slab =
+        block_size < 4096 ? 4096 / block_size : 1;
+};
+
+
+// A pool of the given policy, opened for the lifetime of the object.
+// Allocating calls the mem_new_alloc_* of the policy, deallocating
+// calls mem_del_alloc(); neither is inlined into the caller.
+// note: mem_init() has to be called before, and mem_free() after
+template <class Policy>
+class Pool {
+public:
+    static constexpr alloc_policy policy = Policy::policy;
+
+    explicit Pool(std::size_t size) : pool_(mem_pool_open(size, policy))
+    {
+        if (!pool_) throw std::bad_alloc();
+    }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    Pool(Pool &&other) noexcept : pool_(std::exchange(other.pool_, nullptr)) {}
+
+    Pool &operator=(Pool &&other) noexcept
+    {
+        std::swap(pool_, other.pool_);
+        return *this;
+    }
+
+    // note: fails to close (and leaks) the pool if allocations are live
+    ~Pool() { if (pool_) mem_pool_close(pool_); }
+
+    // NULL if the pool can't make it
+    alloc_pt allocate(std::size_t size) noexcept
+    {
+        return Policy::allocate(pool_, size);
+    }
+
+    alloc_status deallocate(alloc_pt alloc) noexcept
+    {
+        return mem_del_alloc(pool_, alloc);
+    }
+
+    pool_pt get() const noexcept { return pool_; }
+
+private:
+    pool_pt pool_;
+};
+
+
+// A pool handing out blocks of Slab<Size>::block_size bytes, aligned for
+// any type, from slabs of blocks_per_slab blocks allocated from an
+// underlying pool. The free blocks are linked through their first bytes,
+// so allocating and deallocating a block only pops or pushes the list.
+template <std::size_t Size>
+class Pool<Slab<Size>> {
+public:
+    using slab_type = Slab<Size>;
+    static constexpr std::size_t block_size = slab_type::block_size;
+    static constexpr std::size_t blocks_per_slab = slab_type::blocks_per_slab;
+
+    explicit Pool(std::size_t size) : pool_(mem_pool_open(size, FIRST_FIT))
+    {
+        if (!pool_) throw std::bad_alloc();
+    }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    Pool(Pool &&other) noexcept
+        : pool_(std::exchange(other.pool_, nullptr)),
+          slabs_(std::exchange(other.slabs_, nullptr)),
+          free_(std::exchange(other.free_, nullptr)) {}
+
+    Pool &operator=(Pool &&other) noexcept
+    {
+        std::swap(pool_, other.pool_);
+        std::swap(slabs_, other.slabs_);
+        std::swap(free_, other.free_);
+        return *this;
+    }
+
+    ~Pool()
+    {
+        if (!pool_) return;
+        while (slabs_)
+        {
+            slab_header *slab = slabs_;
+            slabs_ = slab->next;
+            mem_del_alloc(pool_, slab->alloc);
+            mem_pool_unpin(pool_);
+        }
+        mem_pool_close(pool_);
+    }
+
+    // NULL if the underlying pool can't make another slab
+    void *allocate() noexcept
+    {
+        if (!free_ && !add_slab()) return nullptr;
+
+        free_block *block = free_;
+        free_ = block->next;
+        return block;
+    }
+
+    void deallocate(void *p) noexcept
+    {
+        free_block *block = static_cast<free_block *>(p);
+        block->next = free_;
+        free_ = block;
+    }
+
+    pool_pt get() const noexcept { return pool_; }
+
+private:
+    struct free_block {
+        free_block *next;
+    };
+
+    // at the start of every slab, in a block of its own
+    struct slab_header {
+        alloc_pt alloc;
+        slab_header *next;
+    };
+
+    static constexpr std::size_t header_size =
+        (sizeof(slab_header) + block_size - 1) / block_size * block_size;
+
+    bool add_slab() noexcept
+    {
+        std::size_t bytes = header_size + blocks_per_slab * block_size
+                            + slab_type::alignment - 1;
+        alloc_pt alloc = mem_new_alloc_first_fit(pool_, bytes);
+        if (!alloc) return false;
+        if (mem_pool_pin(pool_) != ALLOC_OK)
+        {
+            mem_del_alloc(pool_, alloc);
+            return false;
+        }
+
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(alloc->mem);
+        addr = (addr + slab_type::alignment - 1)
+               & ~static_cast<std::uintptr_t>(slab_type::alignment - 1);
+        char *start = reinterpret_cast<char *>(addr);
+
+        slab_header *slab = reinterpret_cast<slab_header *>(start);
+        slab->alloc = alloc;
+        slab->next = slabs_;
+        slabs_ = slab;
+
+        // thread the blocks on the free list, lowest first
+        char *blocks = start + header_size;
+        for (std::size_t i = blocks_per_slab; i-- > 0; )
+        {
+            deallocate(blocks + i * block_size);
+        }
+        return true;
+    }
+
+    pool_pt pool_;
+    slab_header *slabs_ = nullptr;
+    free_block *free_ = nullptr;
+};
+
+
+
+// Owns an allocation: deallocates it when destroyed, unless released.
+// Moving it transfers the allocation, copying it is not allowed.
+class Allocation {
+public:
+    Allocation() noexcept = default;
+
+    // adopts an allocation from the given pool, NULL for none
+    Allocation(pool_pt pool, alloc_pt alloc) noexcept : pool_(pool), alloc_(alloc) {}
+
+    Allocation(const Allocation &) = delete;
+    Allocation &operator=(const Allocation &) = delete;
+
+    Allocation(Allocation &&other) noexcept
+        : pool_(other.pool_), alloc_(std::exchange(other.alloc_, nullptr)) {}
+
+    Allocation &operator=(Allocation &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            pool_ = other.pool_;
+            alloc_ = std::exchange(other.alloc_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Allocation() { reset(); }
+
+    explicit operator bool() const noexcept { return alloc_ != nullptr; }
+
+    alloc_pt get() const noexcept { return alloc_; }
+    pool_pt pool() const noexcept { return pool_; }
+    char *data() const noexcept { return alloc_ ? alloc_->mem : nullptr; }
+    std::size_t size() const noexcept { return alloc_ ? alloc_->size : 0; }
+
+    // gives up ownership, the caller deallocates
+    alloc_pt release() noexcept { return std::exchange(alloc_, nullptr); }
+
+    void reset() noexcept
+    {
+        if (alloc_) mem_del_alloc(pool_, std::exchange(alloc_, nullptr));
+    }
+
+private:
+    pool_pt pool_ = nullptr;
+    alloc_pt alloc_ = nullptr;
+};
+
+// Allocates from the given pool. The allocation is empty if the pool
+// can't make it.
+inline Allocation allocate(pool_pt pool, std::size_t size) noexcept
+{
+    return Allocation(pool, mem_new_alloc(pool, size));
+}
+
+
+// Owns an object constructed in an allocation of its own, like
+// std::unique_ptr: destroys the object and deallocates it when destroyed.
+// note: the object is aligned within the allocation, see make_handle(),
+// and held by address, so the pool is pinned while the handle holds it
+template <class T>
+class Handle {
+public:
+    Handle() noexcept = default;
+
+    Handle(const Handle &) = delete;
+    Handle &operator=(const Handle &) = delete;
+
+    Handle(Handle &&other) noexcept
+        : alloc_(std::move(other.alloc_)), object_(std::exchange(other.object_, nullptr)) {}
+
+    Handle &operator=(Handle &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            alloc_ = std::move(other.alloc_);
+            object_ = std::exchange(other.object_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Handle() { reset(); }
+
+    explicit operator bool() const noexcept { return object_ != nullptr; }
+
+    T *get() const noexcept { return object_; }
+    T &operator*() const noexcept { return *object_; }
+    T *operator->() const noexcept { return object_; }
+
+    // the allocation the object is in
+    const Allocation &allocation() const noexcept { return alloc_; }
+
+    void reset() noexcept
+    {
+        if (!object_) return;
+        std::exchange(object_, nullptr)->~T();
+        pool_pt pool = alloc_.pool();
+        alloc_.reset();
+        mem_pool_unpin(pool);
+    }
+
+private:
+    Handle(Allocation alloc, T *object) noexcept
+        : alloc_(std::move(alloc)), object_(object) {}
+
+    template <class U, class... Args>
+    friend Handle<U> make_handle(pool_pt pool, Args &&...args);
+
+    Allocation alloc_;
+    T *object_ = nullptr;
+};
+
+// Constructs a T from the arguments in a new allocation from the given
+// pool. Throws std::bad_alloc if the pool can't make the allocation, and
+// whatever the constructor throws (after deallocating).
+template <class T, class... Args>
+Handle<T> make_handle(pool_pt pool, Args &&...args)
+{
+    static_assert(!std::is_array<T>::value, "a handle holds a single object");
+
+    // the pool does not align allocations, so leave room to
+    Allocation alloc = allocate(pool, sizeof(T) + alignof(T) - 1);
+    if (!alloc) throw std::bad_alloc();
+
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(alloc.data());
+    addr = (addr + alignof(T) - 1) & ~static_cast<std::uintptr_t>(alignof(T) - 1);
+
+    // pinned before the object is there, unpinned by the handle
+    if (mem_pool_pin(pool) != ALLOC_OK) throw std::bad_alloc();
+    T *object;
+    try
+    {
+        object = ::new (reinterpret_cast<void *>(addr)) T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        mem_pool_unpin(pool);
+        throw;
+    }
+    return Handle<T>(std::move(alloc), object);
+}
+
+} // namespace mem_pool
+
+#endif //DENVER_OS_PA_C_MEM_POOL_HPP
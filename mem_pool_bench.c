@@ -0,0 +1,449 @@
+/*
+ * Microbenchmarks for the mem_pool library, against the C library's
+ * malloc()/free() for comparison.
+ *
+ * Every workload is a deterministic (seeded) sequence of allocations
+ * and deallocations. It is run twice per allocator: once untimed per
+ * operation, for throughput and cycles per operation, and once with
+ * every operation timed, for the latency percentiles. Where the kernel
+ * lets it, the first run also counts the (last level) cache misses.
+ *
+ * usage: mem_pool_bench [-n ops] [-l live] [-g grow] [-p pools]
+ *                       [-s pool_size] [-f frag_nodes] [-k kernel]
+ *                       [-o small_max] [-G guard_period] [-w workload]
+ *                       [-a allocator]
+ */
+
+#define _POSIX_C_SOURCE 199309L // for clock_gettime()
+#ifdef __linux__
+#define _DEFAULT_SOURCE // for syscall()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "mem_pool.h"
+
+
+/*****            constants            *****/
+
+static const unsigned long DEFAULT_OPS       = 200000;
+static const unsigned      DEFAULT_LIVE      = 256;
+static const unsigned      DEFAULT_GROW      = 1024;
+static const unsigned      DEFAULT_POOLS     = 8;
+static const size_t        DEFAULT_POOL_SIZE = 64 << 20;
+static const unsigned      DEFAULT_FRAG_NODES = 131072;
+
+static const size_t        FIXED_SIZE        = 64;
+static const size_t        MIN_RANDOM_SIZE   = 16;
+static const size_t        MAX_RANDOM_SIZE   = 4096;
+static const size_t        MAX_SMALL_SIZE    = 128;
+
+
+/*****              types              *****/
+
+typedef struct _bench_cfg {
+    unsigned long ops; // allocations + deallocations per run
+    unsigned live;     // allocations kept live at a time
+    unsigned grow;     // allocations the growing workload grows to
+    unsigned pools;
+    size_t pool_size;
+    unsigned frag_nodes; // nodes the long_scan workload fragments into
+    size_t small_max;  // small-object tier of the pools, 0 for none
+    unsigned guard_period; // canary sampling (hardened build), 0 for none
+} bench_cfg_t;
+
+// an allocator under test, with up to cfg->pools independent heaps
+typedef struct _allocator {
+    const char *name;
+    alloc_policy policy; // for the mem_pool allocators
+    int is_pool;
+    pool_layout layout;
+} allocator_t;
+
+typedef struct _bench_run {
+    const bench_cfg_t *cfg;
+    const allocator_t *allocator;
+    pool_pt *pools;
+    unsigned long *lat; // per operation, NULL when not timing them
+    unsigned long num_ops;
+    unsigned long failed;
+    unsigned long long seed;
+} bench_run_t;
+
+typedef void (*workload_fn)(bench_run_t *run);
+
+typedef struct _workload {
+    const char *name;
+    workload_fn fn;
+} workload_t;
+
+
+/*****         helper routines         *****/
+
+static unsigned long now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+// a counter of the cache misses of this process, -1 if not available
+static int open_miss_counter() {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static unsigned long long read_counter(int fd) {
+    unsigned long long count = 0;
+#ifdef __linux__
+    if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+#else
+    (void) fd;
+#endif
+    return count;
+}
+
+static unsigned long long now_cycles() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return 0; // not available
+#endif
+}
+
+// xorshift64*, so that every run sees the same sequence
+static unsigned long long next_rand(bench_run_t *run) {
+    run->seed ^= run->seed >> 12;
+    run->seed ^= run->seed << 25;
+    run->seed ^= run->seed >> 27;
+    return run->seed * 2685821657736338717ull;
+}
+
+static size_t random_size(bench_run_t *run) {
+    return MIN_RANDOM_SIZE + next_rand(run) % (MAX_RANDOM_SIZE - MIN_RANDOM_SIZE + 1);
+}
+
+static size_t small_size(bench_run_t *run) {
+    return MIN_RANDOM_SIZE + next_rand(run) % (MAX_SMALL_SIZE - MIN_RANDOM_SIZE + 1);
+}
+
+// one allocation from heap h, touching its first byte
+static void *bench_alloc(bench_run_t *run, unsigned h, size_t size) {
+    unsigned long t0 = run->lat ? now_ns() : 0;
+    void *handle;
+    char *mem;
+
+    if (run->allocator->is_pool) {
+        alloc_pt alloc = mem_new_alloc(run->pools[h], size);
+        handle = alloc;
+        mem = alloc ? alloc->mem : NULL;
+    } else {
+        handle = mem = malloc(size);
+    }
+    if (mem) mem[0] = 1;
+
+    if (run->lat) run->lat[run->num_ops] = now_ns() - t0;
+    run->num_ops++;
+    if (!handle) run->failed++;
+    return handle;
+}
+
+static void bench_free(bench_run_t *run, unsigned h, void *handle) {
+    unsigned long t0 = run->lat ? now_ns() : 0;
+
+    if (run->allocator->is_pool)
+        mem_del_alloc(run->pools[h], (alloc_pt) handle);
+    else
+        free(handle);
+
+    if (run->lat) run->lat[run->num_ops] = now_ns() - t0;
+    run->num_ops++;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *) a;
+    unsigned long y = *(const unsigned long *) b;
+    return (x > y) - (x < y);
+}
+
+
+/*****            workloads            *****/
+
+// random slot of the live set: free it if taken, allocate into it if not
+static void churn(bench_run_t *run, unsigned num_heaps,
+                  size_t (*next_size)(bench_run_t *)) {
+    unsigned num_slots = run->cfg->live * num_heaps;
+    void **slots = calloc(num_slots, sizeof(void *));
+
+    while (run->num_ops < run->cfg->ops) {
+        unsigned s = (unsigned) (next_rand(run) % num_slots);
+        unsigned h = s % num_heaps;
+        if (slots[s]) {
+            bench_free(run, h, slots[s]);
+            slots[s] = NULL;
+        } else {
+            slots[s] = bench_alloc(run, h, next_size ?
+                                   next_size(run) : FIXED_SIZE);
+        }
+    }
+    for (unsigned s = 0; s < num_slots; ++s)
+        if (slots[s]) bench_free(run, s % num_heaps, slots[s]);
+    free(slots);
+}
+
+static void churn_fixed(bench_run_t *run) {
+    churn(run, 1, NULL);
+}
+
+static void churn_random(bench_run_t *run) {
+    churn(run, 1, random_size);
+}
+
+static void churn_small(bench_run_t *run) {
+    churn(run, 1, small_size);
+}
+
+static void many_pools(bench_run_t *run) {
+    churn(run, run->cfg->pools, random_size);
+}
+
+// rounds of allocating the live set, then freeing it in some order
+static void rounds(bench_run_t *run, int lifo) {
+    unsigned live = run->cfg->live;
+    void **slots = calloc(live, sizeof(void *));
+
+    while (run->num_ops < run->cfg->ops) {
+        for (unsigned s = 0; s < live; ++s)
+            slots[s] = bench_alloc(run, 0, random_size(run));
+        for (unsigned s = 0; s < live; ++s) {
+            unsigned ix = lifo ? live - 1 - s : s;
+            if (slots[ix]) bench_free(run, 0, slots[ix]);
+        }
+    }
+    free(slots);
+}
+
+static void lifo(bench_run_t *run) {
+    rounds(run, 1);
+}
+
+static void fifo(bench_run_t *run) {
+    rounds(run, 0);
+}
+
+// two allocations for every deallocation, until the heap has grown
+// to cfg->grow allocations; then it is churned at that size
+static void growing(bench_run_t *run) {
+    unsigned grow = run->cfg->grow;
+    void **slots = calloc(grow, sizeof(void *));
+    unsigned num = 0;
+
+    while (run->num_ops < run->cfg->ops) {
+        if (num < grow && next_rand(run) % 3) {
+            slots[num++] = bench_alloc(run, 0, random_size(run));
+        } else if (num) {
+            unsigned s = (unsigned) (next_rand(run) % num);
+            if (slots[s]) bench_free(run, 0, slots[s]);
+            slots[s] = slots[--num];
+        }
+    }
+    while (num--)
+        if (slots[num]) bench_free(run, 0, slots[num]);
+    free(slots);
+}
+
+// a heap fragmented into cfg->frag_nodes alternating allocations and
+// small gaps, then churned with allocations that only fit at its end,
+// so that first fit scans the whole node heap every time
+static void long_scan(bench_run_t *run) {
+    unsigned frag = run->cfg->frag_nodes / 2;
+    void **slots = calloc(frag, sizeof(void *));
+
+    for (unsigned s = 0; s < frag; ++s)
+        slots[s] = bench_alloc(run, 0, FIXED_SIZE);
+    for (unsigned s = 0; s < frag; s += 2)
+        if (slots[s]) bench_free(run, 0, slots[s]);
+    while (run->num_ops < run->cfg->ops) {
+        void *handle = bench_alloc(run, 0, 2 * FIXED_SIZE);
+        if (handle) bench_free(run, 0, handle);
+    }
+    for (unsigned s = 1; s < frag; s += 2)
+        if (slots[s]) bench_free(run, 0, slots[s]);
+    free(slots);
+}
+
+
+/*****             tables              *****/
+
+static const workload_t WORKLOADS[] = {
+        { "churn_fixed",  churn_fixed },
+        { "churn_random", churn_random },
+        { "churn_small",  churn_small },
+        { "lifo",         lifo },
+        { "fifo",         fifo },
+        { "growing",      growing },
+        { "many_pools",   many_pools },
+        { "long_scan",    long_scan },
+};
+
+static const char *KERNEL_NAMES[] = { "auto", "scalar", "sse4.2", "avx2" };
+
+static const allocator_t ALLOCATORS[] = {
+        { "first_fit", FIRST_FIT, 1, LAYOUT_NODE_HEAP },
+        { "best_fit",  BEST_FIT,  1, LAYOUT_NODE_HEAP },
+        { "next_fit",  NEXT_FIT,  1, LAYOUT_NODE_HEAP },
+        { "addr_fit",  ADDRESS_FIRST_FIT, 1, LAYOUT_NODE_HEAP },
+        { "good_fit",  GOOD_FIT,  1, LAYOUT_NODE_HEAP },
+        { "ff_tags",   FIRST_FIT, 1, LAYOUT_BOUNDARY_TAG },
+        { "bf_tags",   BEST_FIT,  1, LAYOUT_BOUNDARY_TAG },
+        { "malloc",    FIRST_FIT, 0, LAYOUT_NODE_HEAP },
+};
+
+
+/*****             driver              *****/
+
+// one run of a workload, with fresh pools; returns elapsed ns
+static unsigned long run_once(bench_run_t *run, const workload_t *workload,
+                              unsigned long long *cycles, int misses_fd,
+                              unsigned long long *misses) {
+    const bench_cfg_t *cfg = run->cfg;
+
+    if (run->allocator->is_pool) {
+        mem_init();
+        for (unsigned h = 0; h < cfg->pools; ++h) {
+            run->pools[h] = mem_pool_open_layout(cfg->pool_size,
+                                                 run->allocator->policy,
+                                                 run->allocator->layout);
+            if (cfg->small_max)
+                mem_pool_set_small_objects(run->pools[h], cfg->small_max);
+            if (cfg->guard_period)
+                mem_pool_set_guard_sample(run->pools[h], cfg->guard_period);
+        }
+    }
+    run->num_ops = 0;
+    run->failed = 0;
+    run->seed = 0x9E3779B97F4A7C15ull;
+
+    unsigned long long m0 = read_counter(misses_fd);
+    unsigned long long c0 = now_cycles();
+    unsigned long t0 = now_ns();
+    workload->fn(run);
+    unsigned long elapsed = now_ns() - t0;
+    if (cycles) *cycles = now_cycles() - c0;
+    if (misses) *misses = read_counter(misses_fd) - m0;
+
+    if (run->allocator->is_pool) {
+        for (unsigned h = 0; h < cfg->pools; ++h)
+            mem_pool_close(run->pools[h]);
+        mem_free();
+    }
+    return elapsed;
+}
+
+static void bench(const bench_cfg_t *cfg, const workload_t *workload,
+                  const allocator_t *allocator) {
+    pool_pt pools[cfg->pools];
+    bench_run_t run = { cfg, allocator, pools, NULL, 0, 0, 0 };
+
+    // throughput, without timing the single operations
+    unsigned long long cycles, misses;
+    int misses_fd = open_miss_counter();
+    unsigned long elapsed = run_once(&run, workload, &cycles, misses_fd, &misses);
+    unsigned long num_ops = run.num_ops;
+#ifdef __linux__
+    if (misses_fd >= 0) close(misses_fd);
+#endif
+
+    // latencies, now timing every one of them (the same number again)
+    run.lat = calloc(num_ops + 1, sizeof(unsigned long));
+    if (!run.lat) return;
+    run_once(&run, workload, NULL, -1, NULL);
+    qsort(run.lat, run.num_ops, sizeof(unsigned long), compare_ns);
+
+    char misses_per_op[16] = "-";
+    if (misses_fd >= 0 && num_ops)
+        snprintf(misses_per_op, sizeof(misses_per_op), "%.3f",
+                 (double) misses / num_ops);
+
+    printf("%-14s %-10s %10lu %9.2f %10.1f %9s %8lu %8lu %8lu %8lu %8lu\n",
+           workload->name, allocator->name, num_ops,
+           elapsed ? num_ops * 1e3 / elapsed : 0.0,
+           num_ops ? (double) cycles / num_ops : 0.0, misses_per_op,
+           run.lat[run.num_ops / 2],
+           run.lat[run.num_ops * 9 / 10],
+           run.lat[run.num_ops * 99 / 100],
+           run.lat[run.num_ops * 999 / 1000],
+           run.failed);
+    free(run.lat);
+}
+
+int main(int argc, char *argv[]) {
+    bench_cfg_t cfg = { DEFAULT_OPS, DEFAULT_LIVE, DEFAULT_GROW,
+                        DEFAULT_POOLS, DEFAULT_POOL_SIZE, DEFAULT_FRAG_NODES, 0, 0 };
+    const char *only_workload = NULL, *only_allocator = NULL;
+    const char *kernel = KERNEL_NAMES[SCAN_AUTO];
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-n"))      cfg.ops = strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-l")) cfg.live = (unsigned) strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-g")) cfg.grow = (unsigned) strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-p")) cfg.pools = (unsigned) strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-s")) cfg.pool_size = strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-f")) cfg.frag_nodes = (unsigned) strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-k")) kernel = argv[i + 1];
+        else if (!strcmp(argv[i], "-o")) cfg.small_max = strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-G")) cfg.guard_period = (unsigned) strtoul(argv[i + 1], NULL, 10);
+        else if (!strcmp(argv[i], "-w")) only_workload = argv[i + 1];
+        else if (!strcmp(argv[i], "-a")) only_allocator = argv[i + 1];
+        else break;
+    }
+    if (!cfg.ops || !cfg.live || !cfg.grow || !cfg.pools || (argc % 2) == 0) {
+        fprintf(stderr, "usage: %s [-n ops] [-l live] [-g grow] [-p pools]"
+                        " [-s pool_size] [-f frag_nodes] [-k kernel]"
+                        " [-o small_max] [-G guard_period] [-w workload]"
+                        " [-a allocator]\n", argv[0]);
+        return 2;
+    }
+
+    // first-fit scan kernel, for all the pools
+    scan_kernel k = SCAN_AUTO;
+    while (k <= SCAN_AVX2 && strcmp(kernel, KERNEL_NAMES[k])) ++k;
+    if (k > SCAN_AVX2 || mem_set_scan_kernel(k) != ALLOC_OK) {
+        fprintf(stderr, "scan kernel %s not supported\n", kernel);
+        return 2;
+    }
+
+    printf("ops %lu, live %u, grow %u, pools %u, pool size %zu, frag nodes %u,"
+           " scan kernel %s\n\n", cfg.ops, cfg.live, cfg.grow, cfg.pools,
+           cfg.pool_size, cfg.frag_nodes, KERNEL_NAMES[mem_scan_kernel()]);
+    printf("%-14s %-10s %10s %9s %10s %9s %8s %8s %8s %8s %8s\n",
+           "workload", "allocator", "ops", "Mops/s", "cycles/op", "misses/op",
+           "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "failed");
+
+    for (size_t w = 0; w < sizeof(WORKLOADS) / sizeof(WORKLOADS[0]); ++w) {
+        if (only_workload && strcmp(only_workload, WORKLOADS[w].name)) continue;
+        for (size_t a = 0; a < sizeof(ALLOCATORS) / sizeof(ALLOCATORS[0]); ++a) {
+            if (only_allocator && strcmp(only_allocator, ALLOCATORS[a].name)) continue;
+            bench(&cfg, &WORKLOADS[w], &ALLOCATORS[a]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * Standard container benchmarks for the C++ adapters in mem_pool.hpp,
+ * against the default allocator for comparison.
+ *
+ * Every workload is a deterministic (seeded) sequence of container
+ * operations, run with std::allocator, with mem_pool::pool_allocator,
+ * and with std::pmr containers on a mem_pool::pool_resource, each on a
+ * fresh pool of the given policy.
+ *
+ * usage: mem_pool_container_bench [-n ops] [-s pool_size] [-P policy]
+ *                                 [-w workload] [-a allocator]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "mem_pool.hpp"
+
+
+/*****            constants            *****/
+
+static const unsigned long DEFAULT_OPS       = 200000;
+static const size_t        DEFAULT_POOL_SIZE = 256 << 20;
+
+// in alloc_policy order
+static const char *POLICY_NAMES[] = { "first_fit", "best_fit", "next_fit",
+                                      "address_first_fit", "good_fit" };
+static const unsigned NUM_POLICIES = sizeof(POLICY_NAMES) / sizeof(char *);
+
+
+/*****              types              *****/
+
+struct bench_cfg_t {
+    unsigned long ops; // container operations per run
+    size_t pool_size;
+    alloc_policy policy;
+};
+
+// the containers of a workload, for one kind of allocator
+template <class T> using std_vector = std::vector<T>;
+template <class T> using pool_vector = std::vector<T, mem_pool::pool_allocator<T>>;
+
+template <class K, class V>
+using std_map = std::unordered_map<K, V>;
+template <class K, class V>
+using pool_map = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+                                    mem_pool::pool_allocator<std::pair<const K, V>>>;
+
+template <class T> using std_list = std::list<T>;
+template <class T> using pool_list = std::list<T, mem_pool::pool_allocator<T>>;
+
+enum allocator_kind { STD_ALLOCATOR, POOL_ALLOCATOR, PMR_RESOURCE };
+
+struct allocator_t {
+    const char *name;
+    allocator_kind kind;
+};
+
+typedef unsigned long (*workload_fn)(const bench_cfg_t &cfg, allocator_kind kind,
+                                     pool_pt pool);
+
+struct workload_t {
+    const char *name;
+    workload_fn fn;
+};
+
+
+/*****         helper routines         *****/
+
+// xorshift64*, so that every run sees the same sequence
+static unsigned long long next_rand(unsigned long long &seed) {
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ull;
+}
+
+template <class Vector>
+static unsigned long run_vector_push(const bench_cfg_t &cfg, Vector &&vec) {
+    // grows a vector from scratch, over and over, so it reallocates
+    unsigned long checksum = 0;
+    for (unsigned long done = 0; done < cfg.ops; ) {
+        vec.clear();
+        vec.shrink_to_fit();
+        for (unsigned i = 0; i < 4096 && done < cfg.ops; ++i, ++done)
+            vec.push_back(i);
+        checksum += vec.size();
+    }
+    return checksum;
+}
+
+template <class Map>
+static unsigned long run_map_churn(const bench_cfg_t &cfg, Map &&map) {
+    // a map of a steady size, with random keys erased and inserted
+    unsigned long long seed = 88172645463325252ull;
+    unsigned long checksum = 0;
+    for (unsigned long done = 0; done < cfg.ops; ++done) {
+        unsigned key = (unsigned) (next_rand(seed) % 8192);
+        auto it = map.find(key);
+        if (it != map.end()) map.erase(it);
+        else map.emplace(key, done);
+        checksum += map.size();
+    }
+    return checksum;
+}
+
+template <class List>
+static unsigned long run_list_fifo(const bench_cfg_t &cfg, List &&list) {
+    // a queue of a steady length, a node per element
+    unsigned long checksum = 0;
+    for (unsigned long done = 0; done < cfg.ops; ++done) {
+        list.push_back(done);
+        if (list.size() > 1024) {
+            checksum += list.front();
+            list.pop_front();
+        }
+    }
+    return checksum;
+}
+
+
+/*****            workloads            *****/
+
+static unsigned long vector_push(const bench_cfg_t &cfg, allocator_kind kind,
+                                 pool_pt pool) {
+    mem_pool::pool_resource resource(pool);
+    switch (kind) {
+        case STD_ALLOCATOR:
+            return run_vector_push(cfg, std_vector<unsigned>());
+        case POOL_ALLOCATOR:
+            return run_vector_push(cfg, pool_vector<unsigned>(
+                    mem_pool::pool_allocator<unsigned>(pool)));
+        default:
+            return run_vector_push(cfg, std::pmr::vector<unsigned>(&resource));
+    }
+}
+
+static unsigned long map_churn(const bench_cfg_t &cfg, allocator_kind kind,
+                               pool_pt pool) {
+    mem_pool::pool_resource resource(pool);
+    switch (kind) {
+        case STD_ALLOCATOR:
+            return run_map_churn(cfg, std_map<unsigned, unsigned long>());
+        case POOL_ALLOCATOR:
+            return run_map_churn(cfg, pool_map<unsigned, unsigned long>(
+                    0, std::hash<unsigned>(), std::equal_to<unsigned>(),
+                    mem_pool::pool_allocator<unsigned>(pool)));
+        default:
+            return run_map_churn(cfg,
+                    std::pmr::unordered_map<unsigned, unsigned long>(&resource));
+    }
+}
+
+static unsigned long list_fifo(const bench_cfg_t &cfg, allocator_kind kind,
+                               pool_pt pool) {
+    mem_pool::pool_resource resource(pool);
+    switch (kind) {
+        case STD_ALLOCATOR:
+            return run_list_fifo(cfg, std_list<unsigned long>());
+        case POOL_ALLOCATOR:
+            return run_list_fifo(cfg, pool_list<unsigned long>(
+                    mem_pool::pool_allocator<unsigned long>(pool)));
+        default:
+            return run_list_fifo(cfg, std::pmr::list<unsigned long>(&resource));
+    }
+}
+
+
+/*****             tables              *****/
+
+static const workload_t WORKLOADS[] = {
+        { "vector_push", vector_push },
+        { "map_churn",   map_churn },
+        { "list_fifo",   list_fifo },
+};
+
+static const allocator_t ALLOCATORS[] = {
+        { "std",  STD_ALLOCATOR },
+        { "pool", POOL_ALLOCATOR },
+        { "pmr",  PMR_RESOURCE },
+};
+
+
+/*****              main               *****/
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n ops] [-s pool_size] [-P policy] "
+                    "[-w workload] [-a allocator]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    bench_cfg_t cfg = { DEFAULT_OPS, DEFAULT_POOL_SIZE, GOOD_FIT };
+    const char *only_workload = NULL, *only_allocator = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 >= argc) usage(argv[0]);
+        if (!strcmp(argv[i], "-n")) cfg.ops = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-s")) cfg.pool_size = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "-w")) only_workload = argv[++i];
+        else if (!strcmp(argv[i], "-a")) only_allocator = argv[++i];
+        else if (!strcmp(argv[i], "-P")) {
+            const char *name = argv[++i];
+            unsigned u = 0;
+            while (u < NUM_POLICIES && strcmp(name, POLICY_NAMES[u])) ++u;
+            if (u == NUM_POLICIES) usage(argv[0]);
+            cfg.policy = (alloc_policy) u;
+        }
+        else usage(argv[0]);
+    }
+
+    printf("%-12s %-10s %10s %10s %10s\n",
+           "workload", "allocator", "ops", "Mops/s", "ns/op");
+
+    for (const workload_t &workload : WORKLOADS) {
+        if (only_workload && strcmp(only_workload, workload.name)) continue;
+
+        for (const allocator_t &allocator : ALLOCATORS) {
+            if (only_allocator && strcmp(only_allocator, allocator.name)) continue;
+
+            mem_init();
+            pool_pt pool = mem_pool_open(cfg.pool_size, cfg.policy);
+            if (!pool) {
+                fprintf(stderr, "pool open failed\n");
+                return 1;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            unsigned long checksum;
+            try {
+                checksum = workload.fn(cfg, allocator.kind, pool);
+            } catch (const std::bad_alloc &) {
+                fprintf(stderr, "%s/%s: out of pool memory\n",
+                        workload.name, allocator.name);
+                return 1;
+            }
+            double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start).count();
+
+            mem_pool_close(pool);
+            mem_free();
+
+            printf("%-12s %-10s %10lu %10.2f %10.1f\n", workload.name,
+                   allocator.name, cfg.ops, ns ? cfg.ops * 1e3 / ns : 0.0,
+                   cfg.ops ? ns / cfg.ops : 0.0);
+            if (!checksum) fprintf(stderr, "(empty run)\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,475 @@
+/*
+ * Coverage-guided fuzz target for the mem_pool API.
+ *
+ * An input is a program: its first byte picks the configuration of the
+ * pools (policy, layout, deferred coalescing, small-object tier, direct
+ * map, canaries), and every following op byte, with its argument bytes,
+ * opens, allocates in, deallocates from, reallocates in, compacts,
+ * trims, inspects, or closes one of a few pools. Each pool is shadowed by a
+ * reference model of its live allocations (requested size and fill
+ * byte), and after every op the pool must agree with its model and pass
+ * mem_pool_validate(). Any disagreement aborts.
+ *
+ * Built with -DMEM_POOL_LIBFUZZER (clang -fsanitize=fuzzer), libFuzzer
+ * drives LLVMFuzzerTestOneInput(). Otherwise main() runs each file given
+ * (a corpus, or an AFL test case), or stdin if none, or, with -r runs,
+ * that many random inputs of its own, for a quick smoke test.
+ *
+ * usage: mem_pool_fuzz [-r runs | file...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mem_pool.h"
+
+
+/*****            constants            *****/
+
+#define MAX_POOLS 4   // open at a time
+#define MAX_SLOTS 256 // live allocations per pool (enough to grow the node heap)
+#define MAX_CHUNK 8   // segments per mem_inspect_pool_chunk()
+
+static const size_t MIN_POOL_SIZE   = 256;
+static const size_t MAX_SMALL_SIZE  = 1024;    // most allocations
+static const size_t MAX_LARGE_SIZE  = 1 << 18; // the rest
+static const size_t SMALL_MAX       = 128;     // small-object tier
+static const size_t DIRECT_MIN      = 1 << 16; // direct map
+
+static const size_t MAX_INPUT       = 1 << 16; // bytes read per input
+static const size_t RANDOM_INPUT    = 4096;    // bytes per -r input
+
+enum fuzz_op {
+    OP_OPEN, OP_ALLOC, OP_ALLOC_ZEROED, OP_FREE, OP_FREE_TWICE, OP_REALLOC,
+    OP_FREE_BATCH, OP_COMPACT, OP_COMPACT_STEP, OP_TRIM, OP_INSPECT, OP_CLOSE,
+    NUM_OPS
+};
+
+// the config byte
+enum fuzz_flag {
+    FLAG_DEFERRED     = 1 << 3,
+    FLAG_SMALL        = 1 << 4,
+    FLAG_DIRECT       = 1 << 5,
+    FLAG_GUARDS       = 1 << 6,
+    FLAG_BOUNDARY_TAG = 1 << 7
+};
+
+
+/*****              types              *****/
+
+// what a live allocation should be
+typedef struct _slot {
+    alloc_pt alloc; // NULL - free slot
+    size_t size;    // requested
+    unsigned char fill;
+} slot_t;
+
+// a pool and its reference model
+typedef struct _model {
+    pool_pt pool; // NULL - not open
+    slot_t slots[MAX_SLOTS];
+    unsigned num_live;
+    size_t live_size; // requested, of the live allocations
+} model_t;
+
+// what mem_pool_walk() saw
+typedef struct _walk {
+    size_t size;
+    unsigned num_segments;
+    unsigned num_allocated;
+} walk_t;
+
+typedef struct _input {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} input_t;
+
+
+/*****         helper routines         *****/
+
+static unsigned long num_faults[FAULT_OVERRUN + 1];
+
+// a fault is counted, not printed: the double frees are on purpose
+static void count_fault(pool_pt pool, alloc_pt alloc, mem_fault fault) {
+    (void) pool;
+    (void) alloc;
+    num_faults[fault]++;
+}
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "mem_pool_fuzz: %s:%d: check failed: %s\n", \
+                    __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+// the next byte of the input, 0 past its end
+static unsigned next_byte(input_t *in) {
+    return in->pos < in->size ? in->data[in->pos++] : 0;
+}
+
+static size_t next_size(input_t *in) {
+    unsigned bits = next_byte(in) | next_byte(in) << 8;
+
+    // mostly small sizes, sometimes large ones (for the direct map)
+    if (bits & 0x8000) return 1 + (bits & 0x7fff) * (MAX_LARGE_SIZE / 0x8000);
+    return 1 + bits % MAX_SMALL_SIZE;
+}
+
+static int is_direct(unsigned config, size_t size) {
+    return (config & FLAG_DIRECT) && !(config & FLAG_BOUNDARY_TAG) &&
+           size >= DIRECT_MIN;
+}
+
+// if the allocation record is still there after a deallocation, to be
+// deallocated again (the record of a direct-mapped allocation is freed,
+// and so are the records of a slab that empties)
+static int record_outlives(unsigned config, size_t size) {
+    if (config & FLAG_BOUNDARY_TAG) return 1;
+    return !is_direct(config, size) && !((config & FLAG_SMALL) && size <= SMALL_MAX);
+}
+
+// if all the bytes are the given one (each is the same as the next)
+static int all_bytes(const char *mem, size_t size, unsigned char byte) {
+    return (unsigned char) mem[0] == byte && !memcmp(mem, mem + 1, size - 1);
+}
+
+// checks that an allocation still holds what was written to it, all of
+// it (it is of the size requested, and is the caller's to write)
+static void check_slot(const model_t *model, const slot_t *slot, unsigned config) {
+    alloc_pt alloc = slot->alloc;
+    pool_pt pool = model->pool;
+
+    CHECK(alloc->size == slot->size);
+    if (!is_direct(config, slot->size))
+        CHECK(alloc->mem >= pool->mem &&
+              alloc->mem + alloc->size <= pool->mem + pool->total_size);
+    CHECK(all_bytes(alloc->mem, alloc->size, slot->fill));
+}
+
+// checks a pool against its model, and against itself
+static void check_model(const model_t *model) {
+    pool_pt pool = model->pool;
+
+    CHECK(mem_pool_validate(pool) == ALLOC_OK);
+    CHECK(pool->num_allocs == model->num_live);
+    CHECK(pool->alloc_size + pool->direct_size == model->live_size);
+}
+
+// mem_new_alloc() of the pool's own policy, without dispatching on it
+static alloc_pt new_alloc_of_policy(pool_pt pool, size_t size) {
+    switch (pool->policy) {
+        case FIRST_FIT:         return mem_new_alloc_first_fit(pool, size);
+        case BEST_FIT:          return mem_new_alloc_best_fit(pool, size);
+        case NEXT_FIT:          return mem_new_alloc_next_fit(pool, size);
+        case ADDRESS_FIRST_FIT: return mem_new_alloc_address_first_fit(pool, size);
+        case GOOD_FIT:          return mem_new_alloc_good_fit(pool, size);
+    }
+    return NULL;
+}
+
+static int walk_segment(const pool_segment_t *segment, void *ctx) {
+    walk_t *walk = (walk_t *) ctx;
+    walk->size += segment->size;
+    walk->num_segments++;
+    walk->num_allocated += segment->allocated != 0;
+    return 0;
+}
+
+// checks that the three ways to look at a pool see the same segments,
+// and that they add up to no more than the pool
+static void check_inspect(const model_t *model, unsigned chunk, unsigned config) {
+    pool_pt pool = model->pool;
+
+    walk_t walk = { 0, 0, 0 };
+    mem_pool_walk(pool, walk_segment, &walk);
+    CHECK(walk.size <= pool->total_size);
+    // note: a slab is one allocated segment, and an empty one is kept
+    if (!(config & FLAG_SMALL)) CHECK(walk.num_allocated <= pool->num_allocs);
+
+    pool_segment_pt segments = NULL;
+    unsigned num_segments = 0;
+    mem_inspect_pool(pool, &segments, &num_segments);
+    if (!segments) return; // out of memory
+    CHECK(num_segments == walk.num_segments);
+
+    pool_segment_t chunk_segments[MAX_CHUNK];
+    pool_cursor_t cursor = { NULL, 0 };
+    unsigned seen = 0, got;
+    while ((got = mem_inspect_pool_chunk(pool, chunk_segments, chunk, &cursor))) {
+        CHECK(seen + got <= num_segments);
+        CHECK(!memcmp(chunk_segments, segments + seen, got * sizeof(pool_segment_t)));
+        seen += got;
+    }
+    CHECK(seen == num_segments);
+    free(segments);
+
+    float ext_frag = mem_pool_ext_frag(pool);
+    CHECK(ext_frag >= 0.0f && ext_frag <= 1.0f);
+}
+
+static void check_all_slots(const model_t *model, unsigned config) {
+    for (unsigned s = 0; s < MAX_SLOTS; ++s)
+        if (model->slots[s].alloc) check_slot(model, &model->slots[s], config);
+}
+
+static void fill_slot(model_t *model, slot_t *slot, alloc_pt alloc,
+                      size_t size, unsigned char fill) {
+    slot->alloc = alloc;
+    slot->size = size;
+    slot->fill = fill;
+    memset(alloc->mem, fill, alloc->size);
+    model->num_live++;
+    model->live_size += size;
+}
+
+static void free_slot(model_t *model, slot_t *slot) {
+    model->num_live--;
+    model->live_size -= slot->size;
+    slot->alloc = NULL;
+}
+
+static void open_pool(model_t *model, input_t *in, unsigned config) {
+    if (model->pool) return;
+
+    size_t size = MIN_POOL_SIZE + (size_t) next_byte(in) * 4096;
+    alloc_policy policy = (alloc_policy) ((config & 7) % (GOOD_FIT + 1));
+    if (config & FLAG_BOUNDARY_TAG) {
+        // boundary tags only go with these two
+        policy = policy == BEST_FIT ? BEST_FIT : FIRST_FIT;
+        model->pool = mem_pool_open_layout(size, policy, LAYOUT_BOUNDARY_TAG);
+    } else {
+        model->pool = mem_pool_open(size, policy);
+    }
+    CHECK(model->pool);
+    CHECK(model->pool->total_size == size && model->pool->num_allocs == 0);
+    if (config & FLAG_BOUNDARY_TAG) return;
+
+    if (config & FLAG_DEFERRED)
+        CHECK(mem_pool_set_deferred_coalescing(model->pool, 8) == ALLOC_OK);
+    if (config & FLAG_SMALL)
+        CHECK(mem_pool_set_small_objects(model->pool, SMALL_MAX) == ALLOC_OK);
+#ifdef __linux__
+    if (config & FLAG_DIRECT)
+        CHECK(mem_pool_set_direct_map(model->pool, DIRECT_MIN) == ALLOC_OK);
+#endif
+#ifdef MEM_POOL_HARDENED
+    if (config & FLAG_GUARDS)
+        CHECK(mem_pool_set_guard_sample(model->pool, 3) == ALLOC_OK);
+#endif
+}
+
+static void close_pool(model_t *model) {
+    if (model->num_live) {
+        // a pool with live allocations stays open
+        CHECK(mem_pool_close(model->pool) == ALLOC_NOT_FREED);
+        return;
+    }
+    CHECK(mem_pool_close(model->pool) == ALLOC_OK);
+    model->pool = NULL;
+}
+
+// frees every live allocation of the pool, checking them first
+static void drain_pool(model_t *model, unsigned config) {
+    for (unsigned s = 0; s < MAX_SLOTS; ++s) {
+        slot_t *slot = &model->slots[s];
+        if (!slot->alloc) continue;
+        check_slot(model, slot, config);
+        CHECK(mem_del_alloc(model->pool, slot->alloc) == ALLOC_OK);
+        free_slot(model, slot);
+    }
+    check_model(model);
+}
+
+
+/*****           fuzz target           *****/
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    input_t in = { data, size < MAX_INPUT ? size : MAX_INPUT, 0 };
+    static model_t models[MAX_POOLS];
+    memset(models, 0, sizeof(models));
+
+    CHECK(mem_init() == ALLOC_OK);
+    mem_set_fault_handler(count_fault); // fails unless hardened, that's fine
+    unsigned config = next_byte(&in);
+    unsigned char fill = 0;
+
+    while (in.pos < in.size) {
+        unsigned op = next_byte(&in) % NUM_OPS;
+        model_t *model = &models[next_byte(&in) % MAX_POOLS];
+
+        if (op == OP_OPEN) {
+            open_pool(model, &in, config);
+            continue;
+        }
+        if (!model->pool) continue;
+
+        slot_t *slot = &model->slots[next_byte(&in) % MAX_SLOTS];
+        switch (op) {
+            case OP_ALLOC:
+            case OP_ALLOC_ZEROED: {
+                if (slot->alloc) break;
+                size_t alloc_size = next_size(&in);
+                alloc_pt alloc = op == OP_ALLOC_ZEROED ?
+                        mem_new_alloc_zeroed(model->pool, alloc_size) :
+                        alloc_size & 1 ?
+                        new_alloc_of_policy(model->pool, alloc_size) :
+                        mem_new_alloc(model->pool, alloc_size);
+                if (!alloc) break; // out of room is fine, the model says nothing
+                if (op == OP_ALLOC_ZEROED)
+                    CHECK(all_bytes(alloc->mem, alloc->size, 0));
+                fill_slot(model, slot, alloc, alloc_size, ++fill);
+                check_slot(model, slot, config);
+                break;
+            }
+            case OP_FREE:
+            case OP_FREE_TWICE: {
+                if (!slot->alloc) break;
+                check_slot(model, slot, config);
+                CHECK(mem_del_alloc(model->pool, slot->alloc) == ALLOC_OK);
+                if (op == OP_FREE_TWICE && record_outlives(config, slot->size))
+                    CHECK(mem_del_alloc(model->pool, slot->alloc) == ALLOC_FAIL);
+                free_slot(model, slot);
+                break;
+            }
+            case OP_REALLOC: {
+                // the API has no realloc, so it's what a caller would do:
+                // allocate, copy what fits, deallocate
+                if (!slot->alloc) break;
+                size_t new_size = next_size(&in);
+                alloc_pt alloc = mem_new_alloc(model->pool, new_size);
+                if (!alloc) break;
+                check_slot(model, slot, config);
+                size_t kept = new_size < slot->size ? new_size : slot->size;
+                memcpy(alloc->mem, slot->alloc->mem, kept);
+                memset(alloc->mem + kept, slot->fill, alloc->size - kept);
+                CHECK(mem_del_alloc(model->pool, slot->alloc) == ALLOC_OK);
+                model->live_size += new_size - slot->size;
+                slot->alloc = alloc;
+                slot->size = new_size;
+                check_slot(model, slot, config);
+                break;
+            }
+            case OP_FREE_BATCH: {
+                // a run of slots from this one, once with a repeat, which
+                // must fail and change nothing
+                alloc_pt batch[MAX_SLOTS + 1];
+                unsigned num = 0, first = (unsigned) (slot - model->slots);
+                unsigned span = 1 + next_byte(&in) % 8;
+                for (unsigned s = first; s < first + span && s < MAX_SLOTS; ++s)
+                    if (model->slots[s].alloc) batch[num++] = model->slots[s].alloc;
+                if (!num) break;
+                batch[num] = batch[0];
+                CHECK(mem_del_alloc_batch(model->pool, batch, num + 1) == ALLOC_FAIL);
+                check_model(model);
+                CHECK(mem_del_alloc_batch(model->pool, batch, num) == ALLOC_OK);
+                for (unsigned s = first; s < first + span && s < MAX_SLOTS; ++s)
+                    if (model->slots[s].alloc) free_slot(model, &model->slots[s]);
+                break;
+            }
+            case OP_COMPACT:
+                // moves the allocations, not their contents
+                if (config & FLAG_BOUNDARY_TAG)
+                    CHECK(mem_pool_compact(model->pool) == ALLOC_FAIL);
+                else
+                    CHECK(mem_pool_compact(model->pool) == ALLOC_OK);
+                check_all_slots(model, config);
+                break;
+            case OP_COMPACT_STEP:
+                mem_pool_compact_step(model->pool, (size_t) next_byte(&in) << 8);
+                check_all_slots(model, config);
+                break;
+            case OP_TRIM:
+                mem_pool_trim(model->pool);
+                check_all_slots(model, config);
+                break;
+            case OP_INSPECT:
+                check_inspect(model, 1 + next_byte(&in) % MAX_CHUNK, config);
+                break;
+            case OP_CLOSE:
+                close_pool(model);
+                if (!model->pool) continue;
+                break;
+        }
+        check_model(model);
+    }
+
+    // everything goes back, and the library is done with
+    for (unsigned p = 0; p < MAX_POOLS; ++p) {
+        if (!models[p].pool) continue;
+        drain_pool(&models[p], config);
+        close_pool(&models[p]);
+        CHECK(!models[p].pool);
+    }
+    CHECK(mem_free() == ALLOC_OK);
+
+    // nothing here writes past what it asked for
+    CHECK(num_faults[FAULT_OVERRUN] == 0);
+    return 0;
+}
+
+
+/*****              main               *****/
+
+#ifndef MEM_POOL_LIBFUZZER
+static void run_file(FILE *file, const char *name) {
+    uint8_t *data = (uint8_t *) malloc(MAX_INPUT);
+    if (!data) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    size_t size = fread(data, 1, MAX_INPUT, file);
+    if (ferror(file)) {
+        fprintf(stderr, "%s: read failed\n", name);
+        exit(1);
+    }
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && !strcmp(argv[1], "-r")) {
+        // random inputs, from a fixed xorshift64* sequence
+        unsigned long runs = strtoul(argv[2], NULL, 10);
+        unsigned long long seed = 0x9E3779B97F4A7C15ull;
+        uint8_t data[RANDOM_INPUT];
+        for (unsigned long r = 0; r < runs; ++r) {
+            for (size_t i = 0; i < RANDOM_INPUT; ++i) {
+                seed ^= seed >> 12;
+                seed ^= seed << 25;
+                seed ^= seed >> 27;
+                data[i] = (uint8_t) ((seed * 2685821657736338717ull) >> 56);
+            }
+            LLVMFuzzerTestOneInput(data, RANDOM_INPUT);
+        }
+        printf("%lu random inputs passed\n", runs);
+        return 0;
+    }
+    if (argc > 1 && argv[1][0] == '-') {
+        fprintf(stderr, "usage: %s [-r runs | file...]\n", argv[0]);
+        return 2;
+    }
+
+    if (argc == 1) {
+        run_file(stdin, "stdin");
+        return 0;
+    }
+    for (int i = 1; i < argc; ++i) {
+        FILE *file = fopen(argv[i], "rb");
+        if (!file) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(file, argv[i]);
+        fclose(file);
+    }
+    return 0;
+}
+#endif
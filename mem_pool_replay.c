@@ -0,0 +1,302 @@
+/*
+ * Replays a trace recorded with mem_trace_start() against the mem_pool
+ * library, with the recorded layouts and settings of the pools, and
+ * optionally with a different allocation policy, and reports
+ * throughput, latency percentiles, peak footprint and fragmentation.
+ *
+ * usage: mem_pool_replay <trace>
+ *            [recorded|first_fit|best_fit|next_fit|address_first_fit|good_fit]
+ */
+
+#define _POSIX_C_SOURCE 199309L // for clock_gettime()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mem_pool.h"
+#include "mem_trace.h"
+
+
+/*****            constants            *****/
+
+// in alloc_policy order
+static const char *POLICY_NAMES[] = { "first_fit", "best_fit",
+                                      "next_fit", "address_first_fit",
+                                      "good_fit" };
+static const unsigned NUM_POLICIES = sizeof(POLICY_NAMES) / sizeof(char *);
+
+
+/*****              types              *****/
+
+// recorded handle -> live handle, open addressing with linear probing
+typedef struct _handle_entry {
+    uint64_t key; // 0 - empty
+    void *value;  // NULL - deleted (key kept for probing)
+} handle_entry_t;
+
+typedef struct _handle_map {
+    handle_entry_t *entries;
+    size_t capacity; // power of 2
+} handle_map_t;
+
+typedef struct _latencies {
+    unsigned long *ns;
+    size_t count;
+} latencies_t;
+
+
+/*****         helper routines         *****/
+
+static unsigned long now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+static handle_entry_t *map_find(handle_map_t *map, uint64_t key) {
+    size_t mask = map->capacity - 1;
+    size_t i = (size_t) ((key >> 4) * 0x9E3779B97F4A7C15ull) & mask;
+    while (map->entries[i].key && map->entries[i].key != key)
+        i = (i + 1) & mask;
+    return &map->entries[i];
+}
+
+static void map_put(handle_map_t *map, uint64_t key, void *value) {
+    handle_entry_t *entry = map_find(map, key);
+    entry->key = key;
+    entry->value = value;
+}
+
+static void *map_take(handle_map_t *map, uint64_t key) {
+    handle_entry_t *entry = map_find(map, key);
+    void *value = entry->value;
+    entry->value = NULL;
+    return value;
+}
+
+// applies a recorded setting of a pool
+static alloc_status set_config(pool_pt pool, const mem_trace_record_t *rec) {
+    switch (rec->arg) {
+        case TRACE_SET_DEFERRED_COALESCING:
+            return mem_pool_set_deferred_coalescing(pool, (unsigned) rec->size);
+        case TRACE_SET_MAX_WASTE:
+            return mem_pool_set_max_waste(pool, (unsigned) rec->size);
+        case TRACE_SET_SMALL_OBJECTS:
+            return mem_pool_set_small_objects(pool, (size_t) rec->size);
+        case TRACE_SET_DIRECT_MAP:
+            return mem_pool_set_direct_map(pool, (size_t) rec->size);
+        case TRACE_SET_GUARD_SAMPLE:
+            return mem_pool_set_guard_sample(pool, (unsigned) rec->size);
+        default:
+            return ALLOC_FAIL;
+    }
+}
+
+static int compare_ns(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *) a;
+    unsigned long y = *(const unsigned long *) b;
+    return (x > y) - (x < y);
+}
+
+static void print_latencies(const char *name, latencies_t *lat) {
+    if (!lat->count) {
+        printf("%-10s      no calls\n", name);
+        return;
+    }
+
+    unsigned long total = 0;
+    for (size_t i = 0; i < lat->count; ++i)
+        total += lat->ns[i];
+
+    qsort(lat->ns, lat->count, sizeof(unsigned long), compare_ns);
+
+    const double percentiles[] = { 50, 90, 99, 99.9 };
+    printf("%-10s %10zu calls, %8.1f Mops/s, ns/op:", name, lat->count,
+           total ? lat->count * 1e3 / total : 0.0);
+    for (unsigned u = 0; u < sizeof(percentiles) / sizeof(double); ++u)
+        printf(" p%g %lu", percentiles[u],
+               lat->ns[(size_t) (percentiles[u] / 100 * (lat->count - 1))]);
+    printf(" max %lu\n", lat->ns[lat->count - 1]);
+}
+
+
+/*****              main               *****/
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <trace> [recorded", argv[0]);
+        for (unsigned u = 0; u < NUM_POLICIES; ++u)
+            fprintf(stderr, "|%s", POLICY_NAMES[u]);
+        fprintf(stderr, "]\n");
+        return 2;
+    }
+
+    // policy to replay with, -1 for the recorded one
+    int policy = -1;
+    if (argc == 3 && strcmp(argv[2], "recorded")) {
+        for (unsigned u = 0; u < NUM_POLICIES; ++u)
+            if (!strcmp(argv[2], POLICY_NAMES[u]))
+                policy = (int) u;
+        if (policy < 0) {
+            fprintf(stderr, "unknown policy %s\n", argv[2]);
+            return 2;
+        }
+    }
+
+    // read the whole trace up front, so that file I/O is not timed
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        perror(argv[1]);
+        return 1;
+    }
+    mem_trace_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, MEM_TRACE_MAGIC, sizeof(header.magic))
+        || !header.version || header.version > MEM_TRACE_VERSION
+        || header.record_size != sizeof(mem_trace_record_t)) {
+        fprintf(stderr, "%s: not a mem_pool trace\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+    size_t num_records = 0, capacity = 1024;
+    mem_trace_record_t *records = malloc(capacity * sizeof(*records));
+    while (records
+           && fread(&records[num_records], sizeof(*records), 1, file) == 1) {
+        if (++num_records == capacity) {
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(*records));
+        }
+    }
+    fclose(file);
+    if (!records) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    // handles and latencies, at most one entry per record
+    handle_map_t pools = { NULL, 1 }, allocs = { NULL, 1 };
+    while (pools.capacity < 2 * num_records + 2) pools.capacity *= 2;
+    allocs.capacity = pools.capacity;
+    pools.entries = calloc(pools.capacity, sizeof(handle_entry_t));
+    allocs.entries = calloc(allocs.capacity, sizeof(handle_entry_t));
+    latencies_t new_lat = { calloc(num_records + 1, sizeof(unsigned long)), 0 };
+    latencies_t del_lat = { calloc(num_records + 1, sizeof(unsigned long)), 0 };
+    if (!pools.entries || !allocs.entries || !new_lat.ns || !del_lat.ns) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    size_t pool_bytes = 0, peak_pool_bytes = 0;
+    size_t live_bytes = 0, peak_live_bytes = 0;
+    unsigned long skipped = 0, failed = 0, frag_samples = 0;
+    double frag_sum = 0, frag_max = 0;
+
+    mem_init();
+
+    unsigned long start = now_ns();
+    for (size_t i = 0; i < num_records; ++i) {
+        mem_trace_record_t *rec = &records[i];
+        pool_pt pool = NULL;
+        alloc_pt alloc = NULL;
+        unsigned long t0, t1;
+
+        switch (rec->op) {
+            case TRACE_POOL_OPEN:
+                pool = mem_pool_open_layout(rec->size, policy < 0 ?
+                    (alloc_policy) (rec->arg & ((1u << MEM_TRACE_LAYOUT_SHIFT) - 1)) :
+                    (alloc_policy) policy,
+                    (pool_layout) (rec->arg >> MEM_TRACE_LAYOUT_SHIFT));
+                if (!pool) {
+                    fprintf(stderr, "record %zu: pool open failed\n", i);
+                    return 1;
+                }
+                map_put(&pools, rec->pool, pool);
+                pool_bytes += rec->size;
+                if (pool_bytes > peak_pool_bytes) peak_pool_bytes = pool_bytes;
+                break;
+
+            case TRACE_NEW_ALLOC:
+                pool = map_find(&pools, rec->pool)->value;
+                if (!pool || !rec->alloc) {
+                    ++skipped; // failed when recorded
+                    break;
+                }
+                t0 = now_ns();
+                alloc = mem_new_alloc(pool, rec->size);
+                t1 = now_ns();
+                new_lat.ns[new_lat.count++] = t1 - t0;
+                if (!alloc) {
+                    ++failed;
+                    break;
+                }
+                map_put(&allocs, rec->alloc, alloc);
+                live_bytes += alloc->size;
+                if (live_bytes > peak_live_bytes) peak_live_bytes = live_bytes;
+
+                double frag = mem_pool_ext_frag(pool);
+                frag_sum += frag;
+                ++frag_samples;
+                if (frag > frag_max) frag_max = frag;
+                break;
+
+            case TRACE_DEL_ALLOC:
+                pool = map_find(&pools, rec->pool)->value;
+                alloc = map_take(&allocs, rec->alloc);
+                if (!pool || !alloc || rec->arg != ALLOC_OK) {
+                    ++skipped; // failed when recorded, or when replayed
+                    break;
+                }
+                live_bytes -= alloc->size;
+                t0 = now_ns();
+                mem_del_alloc(pool, alloc);
+                t1 = now_ns();
+                del_lat.ns[del_lat.count++] = t1 - t0;
+                break;
+
+            case TRACE_POOL_CONFIG:
+                pool = map_find(&pools, rec->pool)->value;
+                if (!pool || set_config(pool, rec) != ALLOC_OK)
+                    ++skipped; // e.g. max_waste, replayed with another policy
+                break;
+
+            case TRACE_POOL_CLOSE:
+                if (rec->arg != ALLOC_OK) break;
+                pool = map_take(&pools, rec->pool);
+                if (!pool) break;
+                pool_bytes -= pool->total_size;
+                if (mem_pool_close(pool) != ALLOC_OK)
+                    fprintf(stderr, "record %zu: pool close failed\n", i);
+                break;
+
+            default:
+                fprintf(stderr, "record %zu: unknown op %u\n", i, rec->op);
+                return 1;
+        }
+    }
+    unsigned long elapsed = now_ns() - start;
+
+    mem_free();
+
+    printf("trace      %s, %zu records, policy %s\n", argv[1], num_records,
+           policy < 0 ? "recorded" : POLICY_NAMES[policy]);
+    printf("replay     %.3f ms, %.1f Mrecords/s\n", elapsed / 1e6,
+           elapsed ? num_records * 1e3 / elapsed : 0.0);
+    print_latencies("new_alloc", &new_lat);
+    print_latencies("del_alloc", &del_lat);
+    printf("footprint  peak %zu bytes allocated, peak %zu bytes in pools\n",
+           peak_live_bytes, peak_pool_bytes);
+    printf("ext_frag   mean %.4f, max %.4f\n",
+           frag_samples ? frag_sum / frag_samples : 0.0, frag_max);
+    printf("failures   %lu new allocations failed, %lu records skipped\n",
+           failed, skipped);
+
+    free(new_lat.ns);
+    free(del_lat.ns);
+    free(pools.entries);
+    free(allocs.entries);
+    free(records);
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Binary trace format for the mem_pool library calls.
+ *
+ * A trace is a mem_trace_header_t followed by mem_trace_record_t
+ * records, in call order, in host byte order. Traces are recorded
+ * by builds with -DMEM_POOL_TRACE=ON (see mem_trace_start()) and
+ * replayed by the mem_pool_replay tool.
+ */
+
+#ifndef DENVER_OS_PA_C_MEM_TRACE_H
+#define DENVER_OS_PA_C_MEM_TRACE_H
+
+#include <stdint.h>
+
+/* constants */
+
+#define MEM_TRACE_MAGIC "MEMTRACE"
+#define MEM_TRACE_VERSION 2 // 1 had no layout, nor TRACE_POOL_CONFIG
+#define MEM_TRACE_LAYOUT_SHIFT 8 // of the layout in TRACE_POOL_OPEN's arg
+
+/* type declarations */
+
+typedef enum _mem_trace_op {
+    TRACE_POOL_OPEN,  // size, arg = policy | layout << MEM_TRACE_LAYOUT_SHIFT,
+                      // pool = result
+    TRACE_POOL_CLOSE, // pool, arg = status
+    TRACE_NEW_ALLOC,  // pool, size, alloc = result (0 on failure)
+    TRACE_DEL_ALLOC,  // pool, alloc, arg = status
+    TRACE_POOL_CONFIG // pool, arg = mem_trace_setting, size = value (on success)
+} mem_trace_op;
+
+// the per-pool settings, by the function that sets them
+typedef enum _mem_trace_setting {
+    TRACE_SET_DEFERRED_COALESCING, // mem_pool_set_deferred_coalescing()
+    TRACE_SET_MAX_WASTE,           // mem_pool_set_max_waste()
+    TRACE_SET_SMALL_OBJECTS,       // mem_pool_set_small_objects()
+    TRACE_SET_DIRECT_MAP,          // mem_pool_set_direct_map()
+    TRACE_SET_GUARD_SAMPLE         // mem_pool_set_guard_sample()
+} mem_trace_setting;
+
+typedef struct _mem_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} mem_trace_header_t;
+
+typedef struct _mem_trace_record {
+    uint64_t time_ns; // since the start of the trace
+    uint64_t pool;    // pool handle, as recorded
+    uint64_t alloc;   // allocation handle, as recorded
+    uint64_t size;
+    uint32_t op;      // mem_trace_op
+    uint32_t arg;
+} mem_trace_record_t;
+
+#endif //DENVER_OS_PA_C_MEM_TRACE_H
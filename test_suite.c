@@ -4,6 +4,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h> // for SIZE_MAX
+#include <time.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -12,6 +15,9 @@
 #include "cmocka.h"
 #include "mem_pool.h"
 #include "test_suite.h"
+#ifdef MEM_POOL_TRACE
+#include "mem_trace.h"
+#endif
 
 
 /*****             macros              *****/
@@ -29,48 +35,47 @@ static const unsigned POOL_SIZE           = 1000000;
 
 /*****         helper routines         *****/
 
-static void print_pool(pool_pt pool) {
-    pool_segment_pt segs = NULL;
-    unsigned size = 0;
-
-    assert_non_null(pool);
-
-    mem_inspect_pool(pool, &segs, &size);
+typedef struct _pool_check {
+    const pool_segment_t *exp; // NULL to only print
+    unsigned size;
+} pool_check_t;
 
-    assert_non_null(segs);
-    assert_int_not_equal(size, 0);
+static int check_segment(const pool_segment_t *seg, void *ctx) {
+    pool_check_t *check = ctx;
 
 #ifdef INSPECT_POOL
-    for (unsigned u = 0; u < size; u ++)
-        printf("%10lu - %s\n", (unsigned long) segs[u].size, (segs[u].allocated) ? "alloc" : "gap");
+    printf("%10lu - %s\n", (unsigned long) seg->size, (seg->allocated) ? "alloc" : "gap");
 #endif
 
-    if (segs) free(segs);
+    if (check->exp)
+        assert_memory_equal(&check->exp[check->size], seg, sizeof(pool_segment_t));
+    check->size ++;
 
-#ifdef INSPECT_POOL
-    printf("\n");
-#endif
+    return 0;
 }
 
-static void check_pool(pool_pt pool, const pool_segment_pt exp) {
-    pool_segment_pt segs = NULL;
-    unsigned size = 0;
+static void print_pool(pool_pt pool) {
+    pool_check_t check = { NULL, 0 };
 
     assert_non_null(pool);
 
-    mem_inspect_pool(pool, &segs, &size);
+    mem_pool_walk(pool, check_segment, &check);
 
-    assert_non_null(segs);
-    assert_int_not_equal(size, 0);
+    assert_int_not_equal(check.size, 0);
 
 #ifdef INSPECT_POOL
-    for (unsigned u = 0; u < size; u ++)
-        printf("%10lu - %s\n", (unsigned long) segs[u].size, (segs[u].allocated) ? "alloc" : "gap");
+    printf("\n");
 #endif
+}
 
-    assert_memory_equal(exp, segs, size * sizeof(pool_segment_t));
+static void check_pool(pool_pt pool, const pool_segment_pt exp) {
+    pool_check_t check = { exp, 0 };
 
-    if (segs) free(segs);
+    assert_non_null(pool);
+
+    mem_pool_walk(pool, check_segment, &check);
+
+    assert_int_not_equal(check.size, 0);
 
 #ifdef INSPECT_POOL
     printf("\n");
@@ -234,6 +239,57 @@ static void test_pool_nonempty(void **state) {
     assert_int_equal(status, ALLOC_OK);
 }
 
+static void test_pool_store_reuse(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Pool store slot reuse:
+     *
+     * 1. Open and close many pools, one at a time (slots are reused).
+     * 2. Open 100 pools, close every other one, and reopen 50.
+     * 3. The store can't be freed while any pool is open.
+     * 4. Close all pools and free the store.
+     */
+
+    const unsigned num_pools = 100;
+    pool_pt pools[num_pools];
+
+    alloc_status status = mem_init();
+    assert_int_equal(status, ALLOC_OK);
+
+    for (int i=0; i<1000; i++) {
+        pool_pt pool = mem_pool_open(POOL_SIZE, (i % 2) ? FIRST_FIT : BEST_FIT);
+        assert_non_null(pool);
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+
+    for (unsigned i=0; i<num_pools; i++) {
+        pools[i] = mem_pool_open(POOL_SIZE, FIRST_FIT);
+        assert_non_null(pools[i]);
+    }
+    for (unsigned i=1; i<num_pools; i+=2) {
+        assert_int_equal(mem_pool_close(pools[i]), ALLOC_OK);
+    }
+    assert_int_equal(mem_free(), ALLOC_FAIL);
+    for (unsigned i=1; i<num_pools; i+=2) {
+        pools[i] = mem_pool_open(POOL_SIZE, BEST_FIT);
+        assert_non_null(pools[i]);
+        assert_int_equal(pools[i]->policy, BEST_FIT);
+    }
+    for (unsigned i=0; i<num_pools; i+=2) {
+        assert_int_equal(pools[i]->policy, FIRST_FIT);
+    }
+
+    for (unsigned i=0; i<num_pools; i++) {
+        assert_int_equal(mem_pool_close(pools[i]), ALLOC_OK);
+        if (i < num_pools - 1)
+            assert_int_equal(mem_free(), ALLOC_FAIL);
+    }
+
+    status = mem_free();
+    assert_int_equal(status, ALLOC_OK);
+}
+
 
 /*******************************************/
 /***       2. USER-FACING METADATA       ***/
@@ -2319,33 +2375,40 @@ static void test_pool_scenario19(void **state) {
 /***          5. STRESS TEST             ***/
 /***                                     ***/
 /***         [non-functional]            ***/
-/***         [see NOTE below]            ***/
+/***         [timed, see test_suite.h]   ***/
 /*******************************************/
 
+static double elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (now.tv_sec - since->tv_sec) * 1e3 +
+           (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
 void test_pool_stresstest(void **state) {
     (void) state; /* unused */
 
-    const unsigned num_pools = 200;
-    const unsigned num_allocations = 1000;
-    const unsigned min_alloc_size = 10;
-    const unsigned pool_size =
-            (num_allocations / 2) *
-            (2 * min_alloc_size + (num_allocations - 1) * min_alloc_size);
-    assert_int_equal(pool_size, 5005000);
+    const unsigned num_pools = STRESS_NUM_POOLS;
+    const unsigned num_allocations = STRESS_NUM_ALLOCS;
+    const unsigned min_alloc_size = STRESS_MIN_ALLOC_SIZE;
+    const size_t min_pool_size =
+            (size_t) num_allocations * (num_allocations + 1) / 2 * min_alloc_size;
+    const size_t pool_size =
+            STRESS_POOL_SIZE ? STRESS_POOL_SIZE : min_pool_size;
+    assert_true(pool_size >= min_pool_size);
 
 
-    pool_pt pools[num_pools];
-    alloc_pt allocations[num_pools][num_allocations];
+    // on the heap, the defaults are too large for the stack
+    pool_pt *pools = calloc(num_pools, sizeof(pool_pt));
+    alloc_pt *allocations =
+            calloc((size_t) num_pools * num_allocations, sizeof(alloc_pt));
+    assert_non_null(pools);
+    assert_non_null(allocations);
 
     /*
-     * NOTE: This will work iff the address of the allocation
-     * in the pool is returned to the user instead of the
-     * address of the allocation record. Since allocation records
-     * are a part of the nodes, when the node heap is reallocated
-     * the node addresses shift with it, and so do the allocation
-     * record addresses. The allocation addresses on the pool
-     * remain the same, however, so they can be returned to the
-     * user and gotten from the user upon request for deletion.
+     * NOTE: The node heap grows by whole chunks, so the allocation
+     * records handed out to the user never move, no matter how
+     * many allocations are made in a pool.
      */
 
     /*
@@ -2354,61 +2417,1444 @@ void test_pool_stresstest(void **state) {
      * 1. 200 pools of 5005000 each (many pools)
      * 2. In each pool 1000 allocations of different sizes (many allocations)
      * 3. In each pool 500 deallocations (many gaps)
+     * 4. All of it within the wall-time budget (no regressions)
      */
 
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+
     // initialize store
     assert_int_equal(mem_init(), ALLOC_OK);
 
     // allocate pools
     for (unsigned pix=0; pix < num_pools; ++pix) {
+        alloc_pt *pool_allocs = &allocations[(size_t) pix * num_allocations];
         // open pool
         pools[pix] =
                 mem_pool_open(pool_size, (pix % 2) ? FIRST_FIT : BEST_FIT);
         assert_non_null(pools[pix]);
         // allocate pool
-        unsigned allocated = 0;
+        size_t allocated = 0;
         for (unsigned aix=0; aix < num_allocations; ++aix) {
-            allocations[pix][aix] =
+            pool_allocs[aix] =
                     mem_new_alloc(pools[pix], (aix + 1) * min_alloc_size);
             allocated += (aix + 1) * min_alloc_size;
-            if (!allocations[pix][aix]) {
-                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %u\n", pix, aix, allocated);
+            if (!pool_allocs[aix]) {
+                INFO("ASSERT WILL FAIL at pix = %u, aix = %u, allocated = %zu\n", pix, aix, allocated);
             }
-            assert_non_null(allocations[pix][aix]);
+            assert_non_null(pool_allocs[aix]);
         }
         // delete every other allocation
         for (unsigned aix=0; aix < num_allocations; ++aix) {
             if (aix % 2) {
                 assert_int_equal(
-                        mem_del_alloc(pools[pix], allocations[pix][aix]),
+                        mem_del_alloc(pools[pix], pool_allocs[aix]),
                         ALLOC_OK);
-                allocations[pix][aix] = NULL;
+                pool_allocs[aix] = NULL;
             }
         }
+        assert_int_equal(pools[pix]->num_allocs, (num_allocations + 1) / 2);
     }
 
     // delete pools
     for (unsigned pix=0; pix < num_pools; ++pix) {
+        alloc_pt *pool_allocs = &allocations[(size_t) pix * num_allocations];
         // delete pool's allocations
         for (unsigned aix=0; aix < num_allocations; ++aix) {
-            if (allocations[pix][aix]) {
+            if (pool_allocs[aix]) {
                 // delete allocation
                 assert_int_equal(
-                    mem_del_alloc(pools[pix], allocations[pix][aix]),
+                    mem_del_alloc(pools[pix], pool_allocs[aix]),
                     ALLOC_OK);
             }
         }
+        // back to a single gap
+        assert_int_equal(pools[pix]->num_gaps, 1);
         // close pool
         assert_int_equal(mem_pool_close(pools[pix]), ALLOC_OK);
     }
 
     // free store
     assert_int_equal(mem_free(), ALLOC_OK);
+
+    double ms = elapsed_ms(&start);
+    INFO("stress test: %u pools x %u allocations in %.1f ms (budget %d ms)\n",
+         num_pools, num_allocations, ms, STRESS_TIME_BUDGET_MS);
+    assert_true(ms <= STRESS_TIME_BUDGET_MS);
+
+    free(allocations);
+    free(pools);
+}
+
+
+/*******************************************/
+/***          6. EXTENDED API            ***/
+/*******************************************/
+
+static void test_pool_batch_free(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Batch deallocation:
+     *
+     * 1. Allocate 100, 200, 300, 400, 500.
+     * 2. Batch-deallocate the 200, 300, and 500. The first two merge,
+     *    the last one merges into the trailing gap.
+     * 3. Batch-deallocating an already freed allocation fails and
+     *    leaves the pool untouched.
+     * 4. Batch-deallocate the rest. Pool is again one single gap.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    alloc_pt allocs[5];
+    for (int i=0; i<5; ++i) {
+        allocs[i] = mem_new_alloc(pool, (size_t) (i + 1) * 100);
+        assert_non_null(allocs[i]);
+    }
+
+    alloc_pt batch0[3] = { allocs[1], allocs[2], allocs[4] };
+    assert_int_equal(mem_del_alloc_batch(pool, batch0, 3), ALLOC_OK);
+
+    pool_segment_t exp1[4] =
+            {
+                    {100, 1},
+                    {500, 0},
+                    {400, 1},
+                    {pool->total_size - 1000, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 500, 2, 2);
+
+    alloc_pt batch1[2] = { allocs[0], allocs[1] };
+    assert_int_equal(mem_del_alloc_batch(pool, batch1, 2), ALLOC_FAIL);
+    check_pool(pool, exp1);
+
+    alloc_pt batch2[2] = { allocs[3], allocs[0] };
+    assert_int_equal(mem_del_alloc_batch(pool, batch2, 2), ALLOC_OK);
+
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+}
+
+
+static void test_pool_deferred_coalescing(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Deferred coalescing with a budget of 2 deferred blocks:
+     *
+     * 1. Allocate 100, 200, 300.
+     * 2. Deallocate the 200. It is not merged or indexed.
+     * 3. Allocate 200. The deferred block is reused as is.
+     * 4. Deallocate the 100 and the 200. The adjacent gaps stay separate.
+     * 5. Deallocate the 300. Over budget, so everything is merged.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    assert_int_equal(mem_pool_set_deferred_coalescing(pool, 2), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 300);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    pool_segment_t exp1[4] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 1},
+                    {pool->total_size - 600, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 400, 2, 1);
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 200);
+    assert_ptr_equal(alloc3, alloc1);
+
+    pool_segment_t exp2[4] =
+            {
+                    {100, 1},
+                    {200, 1},
+                    {300, 1},
+                    {pool->total_size - 600, 0}
+            };
+    check_pool(pool, exp2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc3), ALLOC_OK);
+
+    pool_segment_t exp3[4] =
+            {
+                    {100, 0},
+                    {200, 0},
+                    {300, 1},
+                    {pool->total_size - 600, 0}
+            };
+    check_pool(pool, exp3);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 300, 1, 1);
+
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    check_pool(pool, exp0);
+    check_metadata(pool, FIRST_FIT, POOL_SIZE, 0, 0, 1);
+
+    assert_int_equal(mem_pool_set_deferred_coalescing(pool, 0), ALLOC_OK);
+}
+
+
+static void test_pool_compaction(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Compaction:
+     *
+     * 1. Allocate 100, 200, 300, 400 and fill the 200 and the 400.
+     * 2. Deallocate the 100 and the 300.
+     * 3. Pinned (twice), the pool doesn't compact, until unpinned
+     *    (twice). Unpinning it once more fails.
+     * 4. Compact one allocation at a time. The 200 moves to the top,
+     *    then the 400 moves right after it. The data moves along.
+     * 5. Compacting a compacted pool does nothing.
+     */
+
+    pool_segment_t exp0[1] =
+            {
+                    {pool->total_size, 0}
+            };
+
+    alloc_pt allocs[4];
+    for (int i=0; i<4; ++i) {
+        allocs[i] = mem_new_alloc(pool, (size_t) (i + 1) * 100);
+        assert_non_null(allocs[i]);
+        memset(allocs[i]->mem, 'a' + i, allocs[i]->size);
+    }
+
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+
+    char *mem1 = allocs[1]->mem;
+    assert_int_equal(mem_pool_pin(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_pin(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_compact(pool), ALLOC_FAIL);
+    assert_int_equal(mem_pool_unpin(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_compact_step(pool, 1), 0);
+    assert_ptr_equal(allocs[1]->mem, mem1);
+    assert_int_equal(mem_pool_unpin(pool), ALLOC_OK);
+    assert_int_equal(mem_pool_unpin(pool), ALLOC_FAIL);
+
+    assert_int_equal(mem_pool_compact_step(pool, 1), 200);
+
+    pool_segment_t exp1[4] =
+            {
+                    {200, 1},
+                    {400, 0},
+                    {400, 1},
+                    {pool->total_size - 1000, 0}
+            };
+    check_pool(pool, exp1);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 600, 2, 2);
+
+    assert_int_equal(mem_pool_compact_step(pool, 1), 400);
+
+    pool_segment_t exp2[3] =
+            {
+                    {200, 1},
+                    {400, 1},
+                    {pool->total_size - 600, 0}
+            };
+    check_pool(pool, exp2);
+    check_metadata(pool, BEST_FIT, POOL_SIZE, 600, 2, 1);
+
+    assert_ptr_equal(allocs[1]->mem, pool->mem);
+    assert_ptr_equal(allocs[3]->mem, pool->mem + 200);
+    for (size_t u = 0; u < 200; ++u) assert_int_equal(allocs[1]->mem[u], 'b');
+    for (size_t u = 0; u < 400; ++u) assert_int_equal(allocs[3]->mem[u], 'd');
+
+    assert_int_equal(mem_pool_compact_step(pool, 1), 0);
+    assert_int_equal(mem_pool_compact(pool), ALLOC_OK);
+    check_pool(pool, exp2);
+
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[3]), ALLOC_OK);
+
+    check_pool(pool, exp0);
+}
+
+
+static void test_pool_frag_metrics(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Fragmentation metrics:
+     *
+     * 1. Pool is a single gap, no fragmentation.
+     * 2. Allocate 100, 1000, 10000.
+     * 3. Deallocate the 1000. Two gaps, 1000 and the rest.
+     * 4. Deallocate the rest. Back to a single gap.
+     */
+
+    assert_int_equal(pool->largest_gap, pool->total_size);
+    assert_int_equal(pool->gap_hist[19], 1); // 2^19 <= 1000000 < 2^20
+    assert_true(mem_pool_ext_frag(pool) == 0.0f);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc1);
+    alloc_pt alloc2 = mem_new_alloc(pool, 10000);
+    assert_non_null(alloc2);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+    size_t rest = pool->total_size - 11100;
+    assert_int_equal(pool->largest_gap, rest);
+    assert_int_equal(pool->gap_hist[9], 1);  // 2^9 <= 1000 < 2^10
+    assert_int_equal(pool->gap_hist[19], 1); // 2^19 <= 988900 < 2^20
+    assert_int_equal(pool->internal_waste, 0);
+    assert_true(mem_pool_ext_frag(pool) > 0.0f);
+    assert_true(mem_pool_ext_frag(pool) == 1.0f - (float) rest / (rest + 1000));
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+
+    assert_int_equal(pool->largest_gap, pool->total_size);
+    assert_int_equal(pool->gap_hist[9], 0);
+    assert_int_equal(pool->gap_hist[19], 1);
+    assert_true(mem_pool_ext_frag(pool) == 0.0f);
+}
+
+
+static void test_pool_stats(void **state) {
+    pool_pt pool = *state;
+    pool_stats_t stats;
+
+    /*
+     * Statistics (only recorded when built with MEM_POOL_STATS):
+     *
+     * 1. Allocate 100 and 1000.
+     * 2. Fail to allocate more than the pool size.
+     * 3. Deallocate both.
+     */
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc0);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1000);
+    assert_non_null(alloc1);
+    assert_null(mem_new_alloc(pool, pool->total_size));
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+
+#ifdef MEM_POOL_STATS
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_OK);
+
+    unsigned long num_allocs = 0, num_dels = 0;
+    for (unsigned u = 0; u < MEM_LATENCY_BUCKETS; ++u) {
+        num_allocs += stats.alloc_ns_hist[u];
+        num_dels += stats.del_ns_hist[u];
+    }
+    assert_int_equal(num_allocs, 3);
+    assert_int_equal(num_dels, 2);
+    assert_int_equal(stats.failed_allocs, 1);
+    assert_true(stats.gap_ix_scans > 0);
+    assert_true(mem_latency_percentile(stats.alloc_ns_hist, 50) > 0);
+#else
+    assert_int_equal(mem_pool_stats(pool, &stats), ALLOC_FAIL);
+#endif
+}
+
+
+static void test_pool_chunked_inspection(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * Inspection in chunks of 2 segments into a caller buffer:
+     *
+     * 1. Allocate 100, 200, 300, 400, 500, and deallocate the 200.
+     * 2. The 6 segments come back in 3 chunks, in order, and
+     *    match what mem_inspect_pool returns.
+     */
+
+    alloc_pt allocs[5];
+    for (int i=0; i<5; ++i) {
+        allocs[i] = mem_new_alloc(pool, (size_t) (i + 1) * 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[1]), ALLOC_OK);
+
+    pool_segment_t exp[6] =
+            {
+                    {100, 1},
+                    {200, 0},
+                    {300, 1},
+                    {400, 1},
+                    {500, 1},
+                    {pool->total_size - 1500, 0}
+            };
+    check_pool(pool, exp);
+
+    pool_segment_pt segs = NULL;
+    unsigned size = 0;
+    mem_inspect_pool(pool, &segs, &size);
+    assert_int_equal(size, 6);
+    assert_memory_equal(exp, segs, size * sizeof(pool_segment_t));
+    free(segs);
+
+    pool_segment_t chunk[2];
+    pool_cursor_t cursor = { NULL, 0 };
+    for (int i=0; i<3; ++i) {
+        assert_int_equal(mem_inspect_pool_chunk(pool, chunk, 2, &cursor), 2);
+        assert_memory_equal(&exp[2 * i], chunk, 2 * sizeof(pool_segment_t));
+    }
+    assert_int_equal(mem_inspect_pool_chunk(pool, chunk, 2, &cursor), 0);
+
+    for (int i=0; i<5; ++i) {
+        if (i != 1)
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+}
+
+
+// opens a pool of 1000 with allocations of 100, 200, 300, 400 and
+// deallocates the 100 and 300 (see the tests below)
+static pool_pt open_policy_pool(alloc_policy policy, alloc_pt allocs[4]) {
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1000, policy);
+    assert_non_null(pool);
+    for (int i=0; i<4; ++i) {
+        allocs[i] = mem_new_alloc(pool, (size_t) (i + 1) * 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    return pool;
+}
+
+static void test_pool_next_fit(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * NEXT_FIT:
+     *
+     * 1. Pool of 1000: 100 gap, 200, 300 gap, 400.
+     * 2. Allocate 50 (top gap, the rover is at the top), then 200
+     *    (the 300 gap), then 40 (where the 200 left off, not the top).
+     * 3. Allocate 50 (again where the rover is), then 30 (the 10 left
+     *    over is too small, so it wraps around to the top).
+     */
+
+    alloc_pt allocs[4];
+    pool_pt pool = open_policy_pool(NEXT_FIT, allocs);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc0->mem - pool->mem, 0);
+    assert_int_equal(alloc1->mem - pool->mem, 300);
+    assert_int_equal(alloc2->mem - pool->mem, 500);
+
+    pool_segment_t exp0[7] =
+            {
+                    {50, 1},
+                    {50, 0},
+                    {200, 1},
+                    {200, 1},
+                    {40, 1},
+                    {60, 0},
+                    {400, 1}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, NEXT_FIT, 1000, 890, 5, 2);
+
+    alloc_pt alloc3 = mem_new_alloc(pool, 50);
+    alloc_pt alloc4 = mem_new_alloc(pool, 30);
+    assert_non_null(alloc3);
+    assert_non_null(alloc4);
+    assert_int_equal(alloc3->mem - pool->mem, 540);
+    assert_int_equal(alloc4->mem - pool->mem, 50);
+
+    alloc_pt rest[7] = { alloc0, alloc1, alloc2, alloc3, alloc4,
+                         allocs[1], allocs[3] };
+    for (int i=0; i<7; ++i) {
+        assert_int_equal(mem_del_alloc(pool, rest[i]), ALLOC_OK);
+    }
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_address_first_fit(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * ADDRESS_FIRST_FIT:
+     *
+     * 1. Pool of 1000: 100 gap, 200, 300 gap, 400.
+     * 2. Allocate 50, 200, 40: always the gap lowest in the pool
+     *    that fits, so the 40 goes right after the 50.
+     */
+
+    alloc_pt allocs[4];
+    pool_pt pool = open_policy_pool(ADDRESS_FIRST_FIT, allocs);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 50);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    alloc_pt alloc2 = mem_new_alloc(pool, 40);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc0->mem - pool->mem, 0);
+    assert_int_equal(alloc1->mem - pool->mem, 300);
+    assert_int_equal(alloc2->mem - pool->mem, 50);
+
+    pool_segment_t exp0[7] =
+            {
+                    {50, 1},
+                    {40, 1},
+                    {10, 0},
+                    {200, 1},
+                    {200, 1},
+                    {100, 0},
+                    {400, 1}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, ADDRESS_FIRST_FIT, 1000, 890, 5, 2);
+
+    alloc_pt rest[5] = { alloc0, alloc1, alloc2, allocs[1], allocs[3] };
+    for (int i=0; i<5; ++i) {
+        assert_int_equal(mem_del_alloc(pool, rest[i]), ALLOC_OK);
+    }
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_good_fit(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * GOOD_FIT:
+     *
+     * 1. Pool of 1000: 100 gap, 200, 300 gap, 400 (no rounding).
+     * 2. Allocate 90 and 97: their blocks are rounded up to 96 and
+     *    104, the next size class boundaries, each from a gap of a
+     *    class above. The allocations keep the sizes requested, and
+     *    the rounding is counted once, as waste.
+     * 3. No rounding with a max waste of 0: allocate 97, then 99,
+     *    which only the 99 gap left over fits, in its own class.
+     * 4. Deallocate everything. No waste left.
+     */
+
+    alloc_pt allocs[4];
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1000, GOOD_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_max_waste(pool, 0), ALLOC_OK);
+    for (int i=0; i<4; ++i) {
+        allocs[i] = mem_new_alloc(pool, (size_t) (i + 1) * 100);
+        assert_non_null(allocs[i]);
+    }
+    assert_int_equal(mem_del_alloc(pool, allocs[0]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, allocs[2]), ALLOC_OK);
+    assert_int_equal(mem_pool_set_max_waste(pool, 12), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 90);
+    alloc_pt alloc1 = mem_new_alloc(pool, 97);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_int_equal(alloc0->size, 90);
+    assert_int_equal(alloc1->size, 97);
+    assert_int_equal(alloc0->mem - pool->mem, 0);
+    assert_int_equal(alloc1->mem - pool->mem, 300);
+    assert_int_equal(pool->alloc_size, 200 + 400 + 90 + 97);
+    assert_int_equal(pool->internal_waste, 13);
+    assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+
+    assert_int_equal(mem_pool_set_max_waste(pool, 0), ALLOC_OK);
+    alloc_pt alloc2 = mem_new_alloc(pool, 97);
+    alloc_pt alloc3 = mem_new_alloc(pool, 99);
+    assert_non_null(alloc2);
+    assert_non_null(alloc3);
+    assert_int_equal(alloc2->mem - pool->mem, 404);
+    assert_int_equal(alloc3->mem - pool->mem, 501);
+
+    pool_segment_t exp0[7] =
+            {
+                    {96, 1},
+                    {4, 0},
+                    {200, 1},
+                    {104, 1},
+                    {97, 1},
+                    {99, 1},
+                    {400, 1}
+            };
+    check_pool(pool, exp0);
+    check_metadata(pool, GOOD_FIT, 1000, 983, 6, 1);
+    assert_int_equal(pool->internal_waste, 13);
+    assert_true(mem_pool_ext_frag(pool) == 0.0f);
+
+    alloc_pt rest[6] = { alloc0, alloc1, alloc2, alloc3,
+                         allocs[1], allocs[3] };
+    for (int i=0; i<6; ++i) {
+        assert_int_equal(mem_del_alloc(pool, rest[i]), ALLOC_OK);
+    }
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(pool->internal_waste, 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    // only GOOD_FIT rounds sizes up
+    pool = mem_pool_open(1000, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_max_waste(pool, 10), ALLOC_FAIL);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_zeroed_alloc(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Zeroed allocations:
+     *
+     * 1. Pool of 1 MB, fresh, so known to be zero. Write to a gap
+     *    behind the pool's back: a zeroed allocation there is not
+     *    zeroed again (and shows the writes).
+     * 2. A block written to and deallocated comes back zeroed.
+     * 3. A gap merged from a written block and a clean one is only
+     *    dirty up to the end of the written part.
+     * 4. Trimming gives the (whole) pages of a written gap back, and
+     *    they read as zeros.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1 << 20, FIRST_FIT);
+    assert_non_null(pool);
+
+    pool->mem[10] = 1;
+    alloc_pt alloc0 = mem_new_alloc_zeroed(pool, 100);
+    assert_non_null(alloc0);
+    assert_int_equal(alloc0->mem[10], 1);
+    alloc0->mem[10] = 0;
+
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc1);
+    memset(alloc1->mem, 0xAB, 200);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    alloc1 = mem_new_alloc_zeroed(pool, 150);
+    assert_non_null(alloc1);
+    for (int i=0; i<150; ++i) {
+        assert_int_equal(alloc1->mem[i], 0);
+    }
+
+    // the 50 left over is dirty, the rest of the pool beyond it is not
+    pool->mem[400] = 1;
+    alloc_pt alloc2 = mem_new_alloc_zeroed(pool, 300);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc2->mem - pool->mem, 250);
+    for (int i=0; i<50; ++i) {
+        assert_int_equal(alloc2->mem[i], 0);
+    }
+    assert_int_equal(pool->mem[400], 1);
+
+    alloc_pt big = mem_new_alloc(pool, 256 << 10);
+    assert_non_null(big);
+    memset(big->mem, 0xCD, big->size);
+    assert_int_equal(mem_del_alloc(pool, big), ALLOC_OK);
+#ifdef __linux__
+    assert_true(mem_pool_trim(pool) >= (size_t) (252 << 10));
+    size_t nonzero = 0; // but for the part of a page the gap starts in
+    for (size_t i=4096; i<(256 << 10); ++i) {
+        nonzero += pool->mem[550 + i] != 0;
+    }
+    assert_int_equal(nonzero, 0);
+#endif
+    big = mem_new_alloc_zeroed(pool, 256 << 10);
+    assert_non_null(big);
+    size_t nonzero_big = 0;
+    for (size_t i=0; i<big->size; ++i) {
+        nonzero_big += big->mem[i] != 0;
+    }
+    assert_int_equal(nonzero_big, 0);
+
+    alloc_pt rest[4] = { alloc0, alloc1, alloc2, big };
+    for (int i=0; i<4; ++i) {
+        assert_int_equal(mem_del_alloc(pool, rest[i]), ALLOC_OK);
+    }
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_small_objects(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Small-object tier:
+     *
+     * 1. Pool of 1 MB, FIRST_FIT, small objects up to 128 bytes. The
+     *    first small allocation makes a slab of 4096 bytes (of 32 byte
+     *    blocks, for 24), the rest of the class fits in it.
+     * 2. A larger size still gets its own node.
+     *    The free blocks of the slab are not free bytes of the pool.
+     * 3. Compaction moves the slab and the blocks with it.
+     * 4. Freeing a block twice fails, a batch takes both kinds.
+     * 5. The empty slab stays, until the pool is closed.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1 << 20, FIRST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_small_objects(pool, 257), ALLOC_FAIL);
+    assert_int_equal(mem_pool_set_small_objects(pool, 128), ALLOC_OK);
+
+    alloc_pt first = mem_new_alloc(pool, 1000);
+    assert_non_null(first);
+
+    alloc_pt small[128];
+    for (int i=0; i<128; ++i) {
+        small[i] = mem_new_alloc(pool, 24);
+        assert_non_null(small[i]);
+        assert_int_equal(small[i]->size, 24);
+        memset(small[i]->mem, i, 24);
+    }
+    assert_int_equal(small[1]->mem - small[0]->mem, 32);
+    assert_int_equal(small[0]->mem - pool->mem, 1000);
+    assert_int_equal(pool->num_allocs, 129);
+    assert_int_equal(pool->alloc_size, 1000 + 128 * 24);
+    assert_int_equal(pool->internal_waste, 128 * 8);
+
+    alloc_pt large = mem_new_alloc(pool, 129);
+    assert_non_null(large);
+    assert_int_equal(large->mem - pool->mem, 1000 + 4096);
+
+    pool_segment_t segs0[] = {
+            {1000, 1},
+            {4096, 1},
+            {129, 1},
+            {(1 << 20) - 1000 - 4096 - 129, 0}
+    };
+    check_pool(pool, segs0);
+    assert_true(mem_pool_ext_frag(pool) == 0.0f);
+
+    assert_int_equal(mem_del_alloc(pool, first), ALLOC_OK);
+    assert_int_equal(mem_pool_compact(pool), ALLOC_OK);
+    assert_int_equal(small[0]->mem - pool->mem, 0);
+    for (int i=0; i<128; ++i) {
+        assert_int_equal(small[i]->mem[23], i);
+    }
+
+    assert_int_equal(mem_del_alloc(pool, small[5]), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, small[5]), ALLOC_FAIL);
+    alloc_pt again = mem_new_alloc_zeroed(pool, 20);
+    assert_ptr_equal(again, small[5]);
+    assert_int_equal(again->mem[0], 0);
+
+    assert_int_equal(mem_del_alloc(pool, small[127]), ALLOC_OK);
+    small[127] = large;
+    assert_int_equal(mem_del_alloc_batch(pool, small, 128), ALLOC_OK);
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->alloc_size, 0);
+    assert_int_equal(pool->internal_waste, 0);
+
+    pool_segment_t segs1[] = {
+            {4096, 1},
+            {(1 << 20) - 4096, 0}
+    };
+    check_pool(pool, segs1);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_direct_map(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Direct-mapped allocations:
+     *
+     * 1. Pool of 1 MB, FIRST_FIT, sizes of 64 KB and up mapped. Such an
+     *    allocation, even one larger than the pool, is outside the pool
+     *    and doesn't touch its gaps; it counts in num_allocs and
+     *    direct_size, but not in alloc_size.
+     * 2. A zeroed one is zero (without being cleared).
+     * 3. The pool can't be closed while one is live, a batch takes
+     *    both kinds.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1 << 20, FIRST_FIT);
+    assert_non_null(pool);
+#ifdef __linux__
+    assert_int_equal(mem_pool_set_direct_map(pool, 4096), ALLOC_FAIL);
+    assert_int_equal(mem_pool_set_direct_map(pool, 64 << 10), ALLOC_OK);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 2 << 20);
+    alloc_pt alloc2 = mem_new_alloc_zeroed(pool, 200000);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_true(alloc1->mem < pool->mem || alloc1->mem >= pool->mem + pool->total_size);
+    memset(alloc1->mem, 0xAB, alloc1->size);
+    size_t nonzero = 0;
+    for (size_t i=0; i<alloc2->size; ++i) {
+        nonzero += alloc2->mem[i] != 0;
+    }
+    assert_int_equal(nonzero, 0);
+
+    assert_int_equal(pool->num_allocs, 3);
+    assert_int_equal(pool->alloc_size, 100);
+    assert_int_equal(pool->direct_size, (2 << 20) + 200000);
+    assert_int_equal(pool->num_gaps, 1);
+
+    pool_segment_t segs[] = {
+            {100, 1},
+            {(1 << 20) - 100, 0}
+    };
+    check_pool(pool, segs);
+
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(pool->direct_size, 200000);
+
+    alloc_pt batch[2] = { alloc2, alloc0 };
+    assert_int_equal(mem_del_alloc_batch(pool, batch, 2), ALLOC_OK);
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->direct_size, 0);
+#else
+    assert_int_equal(mem_pool_set_direct_map(pool, 64 << 10), ALLOC_FAIL);
+#endif
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_boundary_tags(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Boundary-tag pools:
+     *
+     * 1. Pool of 4 KB, FIRST_FIT. Blocks take 24 bytes of tags and are
+     *    rounded up to 16 bytes; the segments are the blocks. The
+     *    allocations are of the sizes requested, and the padding of
+     *    their blocks is counted as waste.
+     * 2. Deallocation merges with the gaps on both sides; a repeated
+     *    one fails, and so does a batch with a repeated allocation.
+     * 3. BEST_FIT takes the smallest gap that fits, and splits it.
+     * 4. Other policies, tiny pools, and the node-heap-only features
+     *    are refused.
+     * 5. The largest gap is kept up to date, and the fragmentation
+     *    counts neither the tags nor the slack after the last block.
+     *    A block that takes all of a gap too small to split has the
+     *    rest as padding.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    assert_null(mem_pool_open_layout(4096, GOOD_FIT, LAYOUT_BOUNDARY_TAG));
+    assert_null(mem_pool_open_layout(32, FIRST_FIT, LAYOUT_BOUNDARY_TAG));
+
+    pool_pt pool = mem_pool_open_layout(4096, FIRST_FIT, LAYOUT_BOUNDARY_TAG);
+    assert_non_null(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1000);
+    alloc_pt alloc2 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_non_null(alloc2);
+    assert_int_equal((size_t) alloc0->mem % 16, 0);
+    assert_int_equal((size_t) alloc1->mem % 16, 0);
+    assert_int_equal(pool->num_allocs, 3);
+    assert_int_equal(alloc0->size, 100);
+    assert_int_equal(pool->alloc_size, 100 + 1000 + 200);
+    assert_int_equal(pool->internal_waste, 4);
+
+    pool_segment_t segs0[] = {
+            {128, 1},
+            {1024, 1},
+            {224, 1},
+            {2720, 0}
+    };
+    check_pool(pool, segs0);
+    check_metadata(pool, FIRST_FIT, 4096, 1300, 3, 1);
+    assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+    assert_int_equal(pool->largest_gap, 2720);
+    assert_true(mem_pool_ext_frag(pool) == 0.0f);
+
+    assert_int_equal(mem_pool_set_small_objects(pool, 64), ALLOC_FAIL);
+    assert_int_equal(mem_pool_set_deferred_coalescing(pool, 16), ALLOC_FAIL);
+    assert_int_equal(mem_pool_compact(pool), ALLOC_FAIL);
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_FAIL);
+
+    pool_segment_t segs1[] = {
+            {128, 1},
+            {3968, 0}
+    };
+    check_pool(pool, segs1);
+    assert_int_equal(pool->largest_gap, 3968);
+
+    alloc1 = mem_new_alloc(pool, 500);
+    assert_non_null(alloc1);
+    assert_int_equal(pool->largest_gap, 3968 - 528);
+    alloc_pt batch[2] = { alloc1, alloc1 };
+    assert_int_equal(mem_del_alloc_batch(pool, batch, 2), ALLOC_FAIL);
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    batch[1] = alloc0;
+    assert_int_equal(mem_del_alloc_batch(pool, batch, 2), ALLOC_OK);
+
+    pool_segment_t segs2[] = {
+            {4096, 0}
+    };
+    check_pool(pool, segs2);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool = mem_pool_open_layout(4096, BEST_FIT, LAYOUT_BOUNDARY_TAG);
+    assert_non_null(pool);
+    alloc0 = mem_new_alloc(pool, 1000);
+    alloc1 = mem_new_alloc(pool, 100);
+    alloc2 = mem_new_alloc(pool, 200);
+    alloc_pt alloc3 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc3);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+
+    alloc_pt alloc4 = mem_new_alloc(pool, 150);
+    assert_ptr_equal(alloc4, alloc2);
+
+    pool_segment_t segs3[] = {
+            {1024, 0},
+            {128, 1},
+            {176, 1},
+            {48, 0},
+            {128, 1},
+            {2592, 0}
+    };
+    check_pool(pool, segs3);
+    assert_int_equal(pool->largest_gap, 2592);
+    assert_true(mem_pool_ext_frag(pool) ==
+                1.0f - (float) (2592 - 24) / (1024 + 48 + 2592 - 3 * 24));
+
+    // taking all of the largest gap leaves the next largest (the 16
+    // bytes left are too few for a gap, so they are padding)
+    size_t waste = pool->internal_waste;
+    alloc_pt alloc5 = mem_new_alloc(pool, 2540);
+    assert_non_null(alloc5);
+    assert_int_equal(alloc5->size, 2540);
+    assert_int_equal(pool->internal_waste, waste + 2592 - 24 - 2540);
+    assert_int_equal(pool->largest_gap, 1024);
+    assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc5), ALLOC_OK);
+    assert_int_equal(pool->largest_gap, 2592);
+    assert_int_equal(pool->internal_waste, waste);
+    assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+
+    alloc_pt batch2[3] = { alloc1, alloc3, alloc4 };
+    assert_int_equal(mem_del_alloc_batch(pool, batch2, 3), ALLOC_OK);
+    check_pool(pool, segs2);
+    assert_int_equal(pool->internal_waste, 0);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+#ifdef MEM_POOL_HARDENED
+static unsigned num_faults[2]; // by mem_fault
+
+static void count_fault(pool_pt pool, alloc_pt alloc, mem_fault fault) {
+    (void) pool;
+    (void) alloc;
+    num_faults[fault]++;
+}
+#endif
+
+static void test_pool_hardening(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Checked deallocations:
+     *
+     * 1. Pool of 1000 bytes, FIRST_FIT. A repeated deallocation (of
+     *    what is a gap by then) fails, and leaves the pool as it was.
+     * 2. In a hardened build, it is also reported. With every
+     *    allocation guarded, an allocation has a canary after it,
+     *    in its node but not in its size, counted as waste. Filling
+     *    the whole allocation is fine, writing past it is reported
+     *    when it's deallocated, which poisons it.
+     * 3. In a hardened build, a block of a slab of another pool, and a
+     *    direct mapping deallocated twice, are reported too, without
+     *    touching either pool (or the freed record).
+     * 4. In a hardened build, a block of a boundary-tag pool whose tag
+     *    (after its padding) was written over is reported, and not
+     *    deallocated, as its size can't be told.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(1000, FIRST_FIT);
+    assert_non_null(pool);
+    alloc_pt alloc0 = mem_new_alloc(pool, 100);
+    alloc_pt alloc1 = mem_new_alloc(pool, 200);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+
+    pool_segment_t segs[] = {
+            {100, 0},
+            {200, 1},
+            {700, 0}
+    };
+    check_pool(pool, segs);
+    assert_int_equal(pool->num_allocs, 1);
+    assert_int_equal(pool->alloc_size, 200);
+
+#ifdef MEM_POOL_HARDENED
+    assert_int_equal(mem_set_fault_handler(count_fault), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_FAIL);
+    assert_int_equal(num_faults[FAULT_BAD_FREE], 1);
+
+    assert_int_equal(mem_pool_set_guard_sample(pool, 1), ALLOC_OK);
+    alloc_pt alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    assert_int_equal(alloc2->size, 100);
+    assert_int_equal(pool->internal_waste, 16);
+    assert_int_equal(pool->alloc_size, 300);
+    pool_segment_t guarded_segs[] = {
+            {100, 0},
+            {200, 1},
+            {116, 1},
+            {584, 0}
+    };
+    check_pool(pool, guarded_segs);
+    memset(alloc2->mem, 'x', alloc2->size);
+    assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(num_faults[FAULT_OVERRUN], 0);
+    check_pool(pool, segs);
+
+    alloc2 = mem_new_alloc(pool, 100);
+    assert_non_null(alloc2);
+    char *mem = alloc2->mem;
+    mem[alloc2->size] = 'x';
+    assert_int_equal(mem_pool_validate(pool), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(pool, alloc2), ALLOC_OK);
+    assert_int_equal(num_faults[FAULT_OVERRUN], 2);
+    assert_int_equal(pool->internal_waste, 0);
+    assert_int_equal((unsigned char) mem[0], 0xDF);
+
+    // in GOOD_FIT, the canary goes right after the allocation, before
+    // the rounding up of its block
+    pool_pt good = mem_pool_open(1000, GOOD_FIT);
+    assert_non_null(good);
+    assert_int_equal(mem_pool_set_guard_sample(good, 1), ALLOC_OK);
+    alloc_pt rounded = mem_new_alloc(good, 97);
+    assert_non_null(rounded);
+    assert_int_equal(rounded->size, 97);
+    assert_int_equal(good->alloc_size, 97);
+    assert_int_equal(good->internal_waste, 16 + 7);
+    memset(rounded->mem, 'x', rounded->size);
+    assert_int_equal(mem_pool_validate(good), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(good, rounded), ALLOC_OK);
+    assert_int_equal(num_faults[FAULT_OVERRUN], 2);
+    assert_int_equal(good->internal_waste, 0);
+    assert_int_equal(mem_pool_close(good), ALLOC_OK);
+
+    pool_pt pool2 = mem_pool_open(1 << 16, FIRST_FIT);
+    pool_pt other = mem_pool_open(1 << 16, FIRST_FIT);
+    assert_non_null(pool2);
+    assert_non_null(other);
+    assert_int_equal(mem_pool_set_small_objects(pool2, 64), ALLOC_OK);
+    assert_int_equal(mem_pool_set_small_objects(other, 64), ALLOC_OK);
+    alloc_pt small = mem_new_alloc(pool2, 32);
+    alloc_pt other_small = mem_new_alloc(other, 32);
+    assert_non_null(small);
+    assert_non_null(other_small);
+    assert_int_equal(mem_del_alloc(other, small), ALLOC_FAIL);
+    assert_int_equal(num_faults[FAULT_BAD_FREE], 2);
+    assert_int_equal(other->num_allocs, 1);
+    assert_int_equal(mem_pool_validate(other), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool2, small), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(other, other_small), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool2), ALLOC_OK);
+
+    if (mem_pool_set_direct_map(other, 65536) == ALLOC_OK) {
+        alloc_pt large = mem_new_alloc(other, 100000);
+        assert_non_null(large);
+        assert_int_equal(mem_del_alloc(other, large), ALLOC_OK);
+        assert_int_equal(mem_del_alloc(other, large), ALLOC_FAIL);
+        assert_int_equal(num_faults[FAULT_BAD_FREE], 3);
+        assert_int_equal(other->num_allocs, 0);
+    }
+    assert_int_equal(mem_pool_close(other), ALLOC_OK);
+
+    pool_pt tagged = mem_pool_open_layout(4096, FIRST_FIT, LAYOUT_BOUNDARY_TAG);
+    assert_non_null(tagged);
+    alloc_pt block = mem_new_alloc(tagged, 100);
+    assert_non_null(block);
+    mem = block->mem;
+    memset(mem, 'x', block->size);
+    assert_int_equal(mem_pool_validate(tagged), ALLOC_OK);
+    char tag = mem[104]; // 128 - 16 (the header) - 8
+    mem[104] = 'x';
+    assert_int_equal(mem_pool_validate(tagged), ALLOC_FAIL);
+    assert_int_equal(mem_del_alloc(tagged, block), ALLOC_FAIL);
+    assert_int_equal(num_faults[FAULT_OVERRUN], 4);
+    assert_int_equal(tagged->num_allocs, 1);
+    mem[104] = tag;
+    assert_int_equal(mem_del_alloc(tagged, block), ALLOC_OK);
+    assert_int_equal(num_faults[FAULT_OVERRUN], 4);
+    assert_int_equal(mem_pool_close(tagged), ALLOC_OK);
+    assert_int_equal(mem_set_fault_handler(NULL), ALLOC_OK);
+#else
+    assert_int_equal(mem_set_fault_handler(NULL), ALLOC_FAIL);
+    assert_int_equal(mem_pool_set_guard_sample(pool, 1), ALLOC_FAIL);
+#endif
+
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_validate(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Validation of the metadata of a pool:
+     *
+     * 1. A pool of each policy (and a boundary-tag one), with a few
+     *    allocations and gaps, is valid after each call.
+     * 2. A pool whose counts, or whose allocation records, were
+     *    written over is not, until they are put back.
+     * 3. An allocation of size 0 fails and leaves the pool valid.
+     */
+
+    const size_t sizes[] = { 100, 3000, 50, 700, 20, 4000 };
+    const unsigned num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    alloc_pt allocs[num_sizes];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    for (unsigned p=0; p<=GOOD_FIT + 1; ++p) {
+        pool_pt pool = p <= GOOD_FIT ?
+                mem_pool_open(1 << 16, (alloc_policy) p) :
+                mem_pool_open_layout(1 << 16, FIRST_FIT, LAYOUT_BOUNDARY_TAG);
+        assert_non_null(pool);
+        assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+        for (unsigned i=0; i<num_sizes; ++i) {
+            allocs[i] = mem_new_alloc(pool, sizes[i]);
+            assert_non_null(allocs[i]);
+            assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+        }
+        for (unsigned i=0; i<num_sizes; i+=2) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+        }
+
+        pool->num_allocs++;
+        assert_int_equal(mem_pool_validate(pool), ALLOC_FAIL);
+        pool->num_allocs--;
+        pool->alloc_size--;
+        assert_int_equal(mem_pool_validate(pool), ALLOC_FAIL);
+        pool->alloc_size++;
+        allocs[1]->size += 8;
+        assert_int_equal(mem_pool_validate(pool), ALLOC_FAIL);
+        allocs[1]->size -= 8;
+        assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+
+        unsigned num_allocs = pool->num_allocs;
+        assert_null(mem_new_alloc(pool, 0));
+        assert_int_equal(pool->num_allocs, num_allocs);
+        assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+
+        for (unsigned i=1; i<num_sizes; i+=2) {
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+            assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+        }
+        assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+
+static void test_pool_huge(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * A pool over 4 GB (where size_t has the bits for it):
+     *
+     * 1. ADDRESS_FIRST_FIT pool of 4 GB + 1 MB, all of it one gap.
+     * 2. Allocate 4 GB and 512 KB, leaving a gap of 512 KB. The
+     *    second allocation is 4 GB into the pool.
+     * 3. Deallocate the first. An allocation of 2 GB takes the top.
+     * 4. Deallocate everything. Pool is again one single gap.
+     *
+     * The pool is never written to, so only its metadata is touched.
+     * If the OS won't hand out that much, there's nothing to check.
+     */
+
+#if SIZE_MAX > 0xFFFFFFFFu
+    const size_t size = (4ull << 30) + (1 << 20);
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(size, ADDRESS_FIRST_FIT);
+    if (!pool) {
+        assert_int_equal(mem_free(), ALLOC_OK);
+        return;
+    }
+    assert_int_equal(pool->total_size, size);
+    assert_int_equal(pool->largest_gap, size);
+
+    alloc_pt alloc0 = mem_new_alloc(pool, 4ull << 30);
+    alloc_pt alloc1 = mem_new_alloc(pool, 1 << 19);
+    assert_non_null(alloc0);
+    assert_non_null(alloc1);
+    assert_int_equal(alloc0->size, 4ull << 30);
+    assert_int_equal(alloc1->mem - pool->mem, 4ull << 30);
+    assert_int_equal(pool->alloc_size, (4ull << 30) + (1 << 19));
+    assert_int_equal(pool->largest_gap, 1 << 19);
+    assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(pool->largest_gap, 4ull << 30);
+    alloc0 = mem_new_alloc(pool, 2ull << 30);
+    assert_non_null(alloc0);
+    assert_ptr_equal(alloc0->mem, pool->mem);
+    assert_int_equal(mem_pool_validate(pool), ALLOC_OK);
+
+    assert_int_equal(mem_del_alloc(pool, alloc0), ALLOC_OK);
+    assert_int_equal(mem_del_alloc(pool, alloc1), ALLOC_OK);
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(pool->largest_gap, size);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+#endif
+}
+
+
+static void test_pool_gap_summary(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * ADDRESS_FIRST_FIT over a pool of many summary regions:
+     *
+     * 1. Pool of 64 MB in 256 allocations of 256 KB.
+     * 2. Deallocate a few, far apart, leaving gaps at known places,
+     *    and two adjacent ones, which merge into a 512 KB gap.
+     * 3. Allocations take the lowest gap that fits, across regions
+     *    and within the region of a gap that is split.
+     * 4. Deallocate everything. Pool is again one single gap.
+     */
+
+    const size_t block = 256 << 10;
+    const unsigned num_blocks = 256;
+    alloc_pt allocs[num_blocks];
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    pool_pt pool = mem_pool_open(block * num_blocks, ADDRESS_FIRST_FIT);
+    assert_non_null(pool);
+    for (unsigned i=0; i<num_blocks; ++i) {
+        allocs[i] = mem_new_alloc(pool, block);
+        assert_non_null(allocs[i]);
+    }
+    assert_null(mem_new_alloc(pool, 1));
+
+    const unsigned freed[] = { 200, 7, 150, 151, 90 };
+    for (unsigned u=0; u<5; ++u) {
+        assert_int_equal(mem_del_alloc(pool, allocs[freed[u]]), ALLOC_OK);
+        allocs[freed[u]] = NULL;
+    }
+    assert_int_equal(pool->num_gaps, 4);
+
+    // only the merged gap fits
+    alloc_pt big = mem_new_alloc(pool, block + 1);
+    assert_non_null(big);
+    assert_int_equal(big->mem - pool->mem, 150 * block);
+
+    // the lowest gap, then what's left of it, then the next one up
+    alloc_pt small0 = mem_new_alloc(pool, block / 2);
+    alloc_pt small1 = mem_new_alloc(pool, block / 2);
+    alloc_pt small2 = mem_new_alloc(pool, block / 2);
+    assert_non_null(small0);
+    assert_non_null(small1);
+    assert_non_null(small2);
+    assert_int_equal(small0->mem - pool->mem, 7 * block);
+    assert_int_equal(small1->mem - pool->mem, 7 * block + block / 2);
+    assert_int_equal(small2->mem - pool->mem, 90 * block);
+
+    // freeing the lowest one makes it the first fit again
+    assert_int_equal(mem_del_alloc(pool, small0), ALLOC_OK);
+    small0 = mem_new_alloc(pool, 100);
+    assert_non_null(small0);
+    assert_int_equal(small0->mem - pool->mem, 7 * block);
+
+    alloc_pt rest[4] = { big, small0, small1, small2 };
+    for (unsigned u=0; u<4; ++u) {
+        assert_int_equal(mem_del_alloc(pool, rest[u]), ALLOC_OK);
+    }
+    for (unsigned i=0; i<num_blocks; ++i) {
+        if (allocs[i])
+            assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+    assert_int_equal(pool->num_gaps, 1);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_scan_kernels(void **state) {
+    pool_pt pool = *state;
+
+    /*
+     * First-fit scan kernels (the ones this CPU supports):
+     *
+     * 1. Allocate 40 of 100, 200, 300, 400, 500, 100, ...
+     * 2. Deallocate the even ones, leaving gaps of 100, 300, 500, 200, ...
+     * 3. With each kernel, allocating 350 takes the 500 gap of the 5th.
+     */
+
+    const scan_kernel kernels[] = { SCAN_SCALAR, SCAN_SSE42, SCAN_AVX2 };
+    alloc_pt allocs[40];
+    for (int i=0; i<40; ++i) {
+        allocs[i] = mem_new_alloc(pool, (size_t) (i % 5 + 1) * 100);
+        assert_non_null(allocs[i]);
+    }
+    char *mem4 = allocs[4]->mem;
+    for (int i=0; i<40; i+=2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+
+    for (unsigned k=0; k<sizeof(kernels)/sizeof(kernels[0]); ++k) {
+        if (mem_set_scan_kernel(kernels[k]) != ALLOC_OK) {
+            assert_int_not_equal(kernels[k], SCAN_SCALAR);
+            continue;
+        }
+        assert_int_equal(mem_scan_kernel(), kernels[k]);
+
+        alloc_pt alloc = mem_new_alloc(pool, 350);
+        assert_non_null(alloc);
+        assert_ptr_equal(alloc->mem, mem4);
+        assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    }
+    assert_int_equal(mem_set_scan_kernel(SCAN_AUTO), ALLOC_OK);
+
+    for (int i=1; i<40; i+=2) {
+        assert_int_equal(mem_del_alloc(pool, allocs[i]), ALLOC_OK);
+    }
+}
+
+static void test_pool_trace(void **state) {
+    (void) state; /* unused */
+
+    const char *path = "test_pool_trace.bin";
+
+    /*
+     * Trace recording (only supported when built with MEM_POOL_TRACE):
+     *
+     * 1. Open a pool, defer coalescing, allocate 100, fail to close
+     *    the pool, deallocate, close it.
+     * 2. Open a boundary-tag pool, fill it up, fail to close it (there
+     *    is no gap), deallocate, close it.
+     * 3. The trace has the 11 calls, in order, with their handles, the
+     *    layouts, and the setting.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+
+#ifdef MEM_POOL_TRACE
+    assert_int_equal(mem_trace_start(path), ALLOC_OK);
+    assert_int_equal(mem_trace_start(path), ALLOC_CALLED_AGAIN);
+#else
+    assert_int_equal(mem_trace_start(path), ALLOC_FAIL);
+#endif
+
+    pool_pt pool = mem_pool_open(POOL_SIZE, BEST_FIT);
+    assert_non_null(pool);
+    assert_int_equal(mem_pool_set_deferred_coalescing(pool, 4), ALLOC_OK);
+    alloc_pt alloc = mem_new_alloc(pool, 100);
+    assert_non_null(alloc);
+    assert_int_equal(mem_pool_close(pool), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(pool, alloc), ALLOC_OK);
+    assert_int_equal(mem_pool_close(pool), ALLOC_OK);
+
+    pool_pt tagged = mem_pool_open_layout(4096, FIRST_FIT, LAYOUT_BOUNDARY_TAG);
+    assert_non_null(tagged);
+    alloc = mem_new_alloc(tagged, 4096 - 24);
+    assert_non_null(alloc);
+    assert_int_equal(tagged->num_gaps, 0);
+    assert_int_equal(mem_pool_close(tagged), ALLOC_NOT_FREED);
+    assert_int_equal(mem_del_alloc(tagged, alloc), ALLOC_OK);
+    assert_int_equal(mem_pool_close(tagged), ALLOC_OK);
+
+#ifdef MEM_POOL_TRACE
+    assert_int_equal(mem_trace_stop(), ALLOC_OK);
+
+    FILE *file = fopen(path, "rb");
+    assert_non_null(file);
+    mem_trace_header_t header;
+    mem_trace_record_t records[12];
+    assert_int_equal(fread(&header, sizeof(header), 1, file), 1);
+    assert_memory_equal(header.magic, MEM_TRACE_MAGIC, sizeof(header.magic));
+    assert_int_equal(header.version, MEM_TRACE_VERSION);
+    assert_int_equal(fread(records, sizeof(records[0]), 12, file), 11);
+    fclose(file);
+    remove(path);
+
+    assert_int_equal(records[0].op, TRACE_POOL_OPEN);
+    assert_int_equal(records[0].size, POOL_SIZE);
+    assert_int_equal(records[0].arg, BEST_FIT);
+    assert_int_equal(records[1].op, TRACE_POOL_CONFIG);
+    assert_int_equal(records[1].arg, TRACE_SET_DEFERRED_COALESCING);
+    assert_int_equal(records[1].size, 4);
+    assert_int_equal(records[2].op, TRACE_NEW_ALLOC);
+    assert_int_equal(records[2].size, 100);
+    assert_int_equal(records[3].op, TRACE_POOL_CLOSE);
+    assert_int_equal(records[3].arg, ALLOC_NOT_FREED);
+    assert_int_equal(records[4].op, TRACE_DEL_ALLOC);
+    assert_int_equal(records[4].alloc, records[2].alloc);
+    assert_int_equal(records[5].op, TRACE_POOL_CLOSE);
+    assert_int_equal(records[5].arg, ALLOC_OK);
+    for (int i=0; i<6; ++i)
+        assert_int_equal(records[i].pool, records[0].pool);
+
+    assert_int_equal(records[6].op, TRACE_POOL_OPEN);
+    assert_int_equal(records[6].arg,
+                     FIRST_FIT | LAYOUT_BOUNDARY_TAG << MEM_TRACE_LAYOUT_SHIFT);
+    assert_int_equal(records[7].op, TRACE_NEW_ALLOC);
+    assert_int_equal(records[8].op, TRACE_POOL_CLOSE);
+    assert_int_equal(records[8].arg, ALLOC_NOT_FREED);
+    assert_int_equal(records[9].op, TRACE_DEL_ALLOC);
+    assert_int_equal(records[10].op, TRACE_POOL_CLOSE);
+    assert_int_equal(records[10].arg, ALLOC_OK);
+    for (int i=6; i<11; ++i)
+        assert_int_equal(records[i].pool, records[6].pool);
+#else
+    assert_int_equal(mem_trace_stop(), ALLOC_FAIL);
+#endif
+
+    assert_int_equal(mem_free(), ALLOC_OK);
 }
 
 
 /*******************************************/
-/***         6. DRIVER ROUTINE           ***/
+/***         7. DRIVER ROUTINE           ***/
 /*******************************************/
 
 int run_test_suite() {
@@ -2417,6 +3863,7 @@ int run_test_suite() {
             cmocka_unit_test(test_pool_smoketest),
 
             cmocka_unit_test(test_pool_nonempty),
+            cmocka_unit_test(test_pool_store_reuse),
 
             cmocka_unit_test_setup_teardown(test_pool_ff_metadata, pool_ff_setup, pool_ff_teardown),
             cmocka_unit_test_setup_teardown(test_pool_bf_metadata, pool_bf_setup, pool_bf_teardown),
@@ -2443,14 +3890,32 @@ int run_test_suite() {
             cmocka_unit_test_setup_teardown(test_pool_scenario18, pool_bf_setup, pool_bf_teardown),
             cmocka_unit_test_setup_teardown(test_pool_scenario19, pool_bf_setup, pool_bf_teardown),
 
-            // do not uncomment until the project is changed to return the allocation address
-//            cmocka_unit_test(test_pool_stresstest),
+            cmocka_unit_test_setup_teardown(test_pool_batch_free, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_deferred_coalescing, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_compaction, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_frag_metrics, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_stats, pool_bf_setup, pool_bf_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_chunked_inspection, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_scan_kernels, pool_ff_setup, pool_ff_teardown),
+            cmocka_unit_test(test_pool_next_fit),
+            cmocka_unit_test(test_pool_address_first_fit),
+            cmocka_unit_test(test_pool_gap_summary),
+            cmocka_unit_test(test_pool_huge),
+            cmocka_unit_test(test_pool_good_fit),
+            cmocka_unit_test(test_pool_zeroed_alloc),
+            cmocka_unit_test(test_pool_small_objects),
+            cmocka_unit_test(test_pool_direct_map),
+            cmocka_unit_test(test_pool_boundary_tags),
+            cmocka_unit_test(test_pool_hardening),
+            cmocka_unit_test(test_pool_validate),
+            cmocka_unit_test(test_pool_trace),
+
+            cmocka_unit_test(test_pool_stresstest),
     };
 
     return cmocka_run_group_tests_name("pool_test_suite", tests, NULL, NULL);
 }
 
 /* future editions */
-// TODO stress test: many pools, many allocations, many gaps (requires project refactoring, see NOTE in test body)
 // TODO test memory leaks: any way to do it w/o having to rewrite the source file?
 // TODO fix the final PASSED line of std::cerr output to the end of the file (?)
@@ -8,6 +8,23 @@
 #define NUM_ITERATIONS 6
 #define INSPECT_POOL // define if you want to see pool inspections in the output
 
+// stress test scale and wall-time budget, override with -D to rescale
+#ifndef STRESS_NUM_POOLS
+#define STRESS_NUM_POOLS 200
+#endif
+#ifndef STRESS_NUM_ALLOCS
+#define STRESS_NUM_ALLOCS 1000
+#endif
+#ifndef STRESS_MIN_ALLOC_SIZE
+#define STRESS_MIN_ALLOC_SIZE 10
+#endif
+#ifndef STRESS_POOL_SIZE // 0 - just large enough for the allocations
+#define STRESS_POOL_SIZE 0
+#endif
+#ifndef STRESS_TIME_BUDGET_MS
+#define STRESS_TIME_BUDGET_MS 10000
+#endif
+
 int run_test_suite();
 
 #endif //DENVER_OS_PA_C_TEST_SUITE_H
@@ -0,0 +1,396 @@
+//
+// Tests for the C++ layer over the mem_pool library.
+//
+
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <map>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+
+extern "C" {
+#include "cmocka.h" // note: only declares its functions as C in part
+}
+#include "mem_pool.hpp"
+
+
+/*****            constants            *****/
+
+static const size_t POOL_SIZE = 1000000;
+
+
+/*****         helper routines         *****/
+
+static int pool_setup(void **state) {
+    if (mem_init() != ALLOC_OK) return -1;
+    pool_pt pool = mem_pool_open(POOL_SIZE, FIRST_FIT);
+    if (!pool) return -1;
+    *state = pool;
+    return 0;
+}
+
+static int pool_teardown(void **state) {
+    pool_pt pool = static_cast<pool_pt>(*state);
+    if (mem_pool_close(pool) != ALLOC_OK) return -1;
+    return mem_free() == ALLOC_OK ? 0 : -1;
+}
+
+
+/*****              tests              *****/
+
+static void test_pool_allocator_containers(void **state) {
+    pool_pt pool = static_cast<pool_pt>(*state);
+
+    /*
+     * pool_allocator:
+     *
+     * 1. A vector, a list and an unordered_map on the pool allocate
+     *    from it, and give everything back when they go away.
+     * 2. Copies and rebinds of an allocator are equal to it.
+     */
+
+    {
+        mem_pool::pool_allocator<int> alloc(pool);
+        std::vector<int, mem_pool::pool_allocator<int>> vec(alloc);
+        std::list<int, mem_pool::pool_allocator<int>> list(alloc);
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           mem_pool::pool_allocator<std::pair<const int, int>>>
+                map(0, std::hash<int>(), std::equal_to<int>(), alloc);
+
+        for (int i=0; i<1000; ++i) {
+            vec.push_back(i);
+            list.push_back(i);
+            map.emplace(i, 2 * i);
+        }
+        assert_true(pool->num_allocs > 1000);
+        for (int i=0; i<1000; ++i) {
+            assert_int_equal(vec[i], i);
+            assert_int_equal(map.at(i), 2 * i);
+        }
+
+        mem_pool::pool_allocator<double> rebound(alloc);
+        assert_true(rebound == alloc);
+        assert_ptr_equal(rebound.pool(), pool);
+    }
+    assert_int_equal(pool->num_allocs, 0);
+    assert_int_equal(pool->num_gaps, 1);
+}
+
+static void test_pool_resource(void **state) {
+    pool_pt pool = static_cast<pool_pt>(*state);
+
+    /*
+     * pool_resource:
+     *
+     * 1. Blocks are aligned as asked for, up to a page.
+     * 2. pmr containers allocate from the pool.
+     * 3. Resources on the same pool are equal, on different ones not.
+     * 4. An allocation the pool can't make throws bad_alloc.
+     */
+
+    mem_pool::pool_resource resource(pool);
+
+    void *blocks[13];
+    for (unsigned u=0; u<13; ++u) {
+        size_t alignment = size_t(1) << u;
+        blocks[u] = resource.allocate(3 * u + 1, alignment);
+        assert_int_equal(reinterpret_cast<std::uintptr_t>(blocks[u]) % alignment, 0);
+        assert_true(static_cast<char *>(blocks[u]) >= pool->mem);
+        assert_true(static_cast<char *>(blocks[u]) + 3 * u + 1 <= pool->mem + POOL_SIZE);
+    }
+    assert_int_equal(pool->num_allocs, 13);
+    for (unsigned u=0; u<13; ++u) {
+        resource.deallocate(blocks[u], 3 * u + 1, size_t(1) << u);
+    }
+    assert_int_equal(pool->num_allocs, 0);
+
+    {
+        std::pmr::map<int, std::pmr::vector<int>> map(&resource);
+        for (int i=0; i<100; ++i) {
+            map[i].assign(i, i);
+        }
+        assert_int_equal(map[50].size(), 50);
+        assert_true(pool->num_allocs >= 199);
+    }
+    assert_int_equal(pool->num_allocs, 0);
+
+    mem_pool::pool_resource same(pool);
+    assert_true(resource == same);
+    assert_false(resource == *std::pmr::new_delete_resource());
+
+    bool thrown = false;
+    try {
+        void *block = resource.allocate(2 * POOL_SIZE);
+        resource.deallocate(block, 2 * POOL_SIZE);
+    } catch (const std::bad_alloc &) {
+        thrown = true;
+    }
+    assert_true(thrown);
+    assert_int_equal(pool->num_gaps, 1);
+}
+
+static void test_pool_policy_templates(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Pool<Policy>:
+     *
+     * 1. Pool<FirstFit> and Pool<BestFit> open pools of their policy.
+     * 2. Pools of 1000: 100 gap, 200, 300 gap, 400 (FirstFit) and
+     *    100 gap, 200, 75 gap, 400, 225 gap (BestFit). An allocation of
+     *    50 takes the top gap with FirstFit, and the 75 gap with BestFit.
+     */
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    {
+        mem_pool::Pool<mem_pool::FirstFit> first(1000);
+        mem_pool::Pool<mem_pool::BestFit> best(1000);
+        assert_int_equal(first.get()->policy, FIRST_FIT);
+        assert_int_equal(best.get()->policy, BEST_FIT);
+        static_assert(mem_pool::Pool<mem_pool::GoodFit>::policy == GOOD_FIT, "");
+
+        alloc_pt first_allocs[4], best_allocs[4];
+        for (int i=0; i<4; ++i) {
+            first_allocs[i] = first.allocate((size_t) (i + 1) * 100);
+            best_allocs[i] = best.allocate((size_t) (i + 1) * (i == 2 ? 25 : 100));
+            assert_non_null(first_allocs[i]);
+            assert_non_null(best_allocs[i]);
+        }
+        assert_int_equal(first.deallocate(first_allocs[0]), ALLOC_OK);
+        assert_int_equal(first.deallocate(first_allocs[2]), ALLOC_OK);
+        assert_int_equal(best.deallocate(best_allocs[0]), ALLOC_OK);
+        assert_int_equal(best.deallocate(best_allocs[2]), ALLOC_OK);
+
+        alloc_pt a = first.allocate(50);
+        alloc_pt b = best.allocate(50);
+        assert_int_equal(a->mem - first.get()->mem, 0);
+        assert_int_equal(b->mem - best.get()->mem, 300);
+
+        assert_int_equal(first.deallocate(a), ALLOC_OK);
+        assert_int_equal(best.deallocate(b), ALLOC_OK);
+        for (int i=1; i<4; i+=2) {
+            assert_int_equal(first.deallocate(first_allocs[i]), ALLOC_OK);
+            assert_int_equal(best.deallocate(best_allocs[i]), ALLOC_OK);
+        }
+        assert_null(first.allocate(1001));
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+static void test_pool_slab(void **state) {
+    (void) state; /* unused */
+
+    /*
+     * Pool<Slab<Size>>:
+     *
+     * 1. Block sizes are rounded up to the alignment, at compile time.
+     * 2. Blocks are distinct and aligned, and come from the pool, a
+     *    slab at a time.
+     * 3. A deallocated block is the next one allocated.
+     * 4. Allocation fails once the pool can't make another slab.
+     */
+
+    using slab_pool = mem_pool::Pool<mem_pool::Slab<24>>;
+    static_assert(slab_pool::block_size == 32, "");
+    static_assert(mem_pool::Slab<1>::block_size == alignof(std::max_align_t), "");
+    static_assert(mem_pool::Slab<4096>::blocks_per_slab == 1, "");
+
+    assert_int_equal(mem_init(), ALLOC_OK);
+    {
+        slab_pool pool(64 * 1024);
+        const unsigned num_blocks = 3 * slab_pool::blocks_per_slab;
+        std::vector<char *> blocks;
+        for (unsigned u=0; u<num_blocks; ++u) {
+            char *block = static_cast<char *>(pool.allocate());
+            assert_non_null(block);
+            assert_int_equal(reinterpret_cast<std::uintptr_t>(block)
+                             % alignof(std::max_align_t), 0);
+            assert_true(block >= pool.get()->mem);
+            memset(block, (int) u, slab_pool::block_size);
+            blocks.push_back(block);
+        }
+        assert_int_equal(pool.get()->num_allocs, 3);
+        for (unsigned u=0; u<num_blocks; ++u) {
+            assert_int_equal(blocks[u][slab_pool::block_size - 1], (char) u);
+        }
+
+        pool.deallocate(blocks[7]);
+        assert_ptr_equal(pool.allocate(), blocks[7]);
+
+        while (pool.allocate()) {}
+        assert_true(pool.get()->num_allocs > 3);
+    }
+    assert_int_equal(mem_free(), ALLOC_OK);
+}
+
+namespace {
+
+// counts its live instances
+struct alignas(32) tracked {
+    static int live;
+    int value;
+    explicit tracked(int v) : value(v) { ++live; }
+    ~tracked() { --live; }
+};
+int tracked::live = 0;
+
+// larger than the pool
+struct huge {
+    char bytes[2000000];
+};
+
+}
+
+static void test_pool_raii_handles(void **state) {
+    pool_pt pool = static_cast<pool_pt>(*state);
+
+    /*
+     * Allocation and Handle<T>:
+     *
+     * 1. An Allocation deallocates when it goes out of scope, unless
+     *    released, and moving it transfers the allocation.
+     * 2. make_handle constructs an aligned object in an allocation,
+     *    and the Handle destroys and deallocates it.
+     * 3. A moved Pool<Policy> closes its pool only once.
+     */
+
+    {
+        mem_pool::Allocation a = mem_pool::allocate(pool, 100);
+        assert_true(static_cast<bool>(a));
+        assert_int_equal(a.size(), 100);
+        assert_int_equal(pool->num_allocs, 1);
+
+        mem_pool::Allocation b = std::move(a);
+        assert_false(static_cast<bool>(a));
+        assert_true(static_cast<bool>(b));
+        assert_int_equal(pool->num_allocs, 1);
+
+        std::vector<mem_pool::Allocation> many;
+        for (int i=0; i<10; ++i) {
+            many.push_back(mem_pool::allocate(pool, 10));
+        }
+        assert_int_equal(pool->num_allocs, 11);
+        many.erase(many.begin(), many.begin() + 5);
+        assert_int_equal(pool->num_allocs, 6);
+
+        alloc_pt released = mem_pool::allocate(pool, 20).release();
+        assert_int_equal(pool->num_allocs, 7);
+        assert_int_equal(mem_del_alloc(pool, released), ALLOC_OK);
+
+        assert_false(static_cast<bool>(mem_pool::allocate(pool, 2 * POOL_SIZE)));
+    }
+    assert_int_equal(pool->num_allocs, 0);
+
+    {
+        mem_pool::Handle<tracked> h = mem_pool::make_handle<tracked>(pool, 7);
+        assert_int_equal(tracked::live, 1);
+        assert_int_equal(h->value, 7);
+        assert_int_equal(reinterpret_cast<std::uintptr_t>(h.get()) % 32, 0);
+        assert_true(reinterpret_cast<char *>(h.get()) >= h.allocation().data());
+
+        mem_pool::Handle<tracked> g;
+        g = std::move(h);
+        assert_false(static_cast<bool>(h));
+        assert_int_equal((*g).value, 7);
+        assert_int_equal(tracked::live, 1);
+        assert_int_equal(pool->num_allocs, 1);
+
+        g.reset();
+        assert_int_equal(tracked::live, 0);
+        assert_int_equal(pool->num_allocs, 0);
+
+        h = mem_pool::make_handle<tracked>(pool, 8);
+        bool thrown = false;
+        try {
+            mem_pool::make_handle<huge>(pool);
+        } catch (const std::bad_alloc &) {
+            thrown = true;
+        }
+        assert_true(thrown);
+    }
+    assert_int_equal(tracked::live, 0);
+    assert_int_equal(pool->num_allocs, 0);
+
+    mem_pool::Pool<mem_pool::FirstFit> first(1000);
+    mem_pool::Pool<mem_pool::FirstFit> moved(std::move(first));
+    assert_null(first.get());
+    assert_non_null(moved.get());
+    {
+        mem_pool::Allocation a(moved.get(), moved.allocate(10));
+        assert_true(static_cast<bool>(a));
+    }
+    assert_int_equal(moved.get()->num_allocs, 0);
+}
+
+static void test_pool_compaction_pins(void **state) {
+    pool_pt pool = static_cast<pool_pt>(*state);
+
+    /*
+     * Compaction of a pool with C++ owners:
+     *
+     * 1. A live block of a pool_resource, or a pool_allocator
+     *    container, or a live Handle, pins the pool: it doesn't
+     *    compact. Once they are gone, it does.
+     * 2. An Allocation doesn't pin it, and follows its data when it
+     *    moves.
+     * 3. A Pool<Slab<Size>> pins its pool while it has slabs.
+     */
+
+    mem_pool::Allocation gap = mem_pool::allocate(pool, 100);
+    mem_pool::Allocation a = mem_pool::allocate(pool, 100);
+    assert_true(static_cast<bool>(gap) && static_cast<bool>(a));
+    memset(a.data(), 'a', a.size());
+    gap.reset();
+
+    {
+        mem_pool::pool_resource resource(pool);
+        void *block = resource.allocate(10, 8);
+        assert_int_equal(mem_pool_compact(pool), ALLOC_FAIL);
+        resource.deallocate(block, 10, 8);
+
+        std::vector<int, mem_pool::pool_allocator<int>> vec(
+                (mem_pool::pool_allocator<int>(pool)));
+        vec.assign(10, 1);
+        assert_int_equal(mem_pool_compact_step(pool, 1), 0);
+    }
+    {
+        mem_pool::Handle<tracked> h = mem_pool::make_handle<tracked>(pool, 1);
+        mem_pool::Handle<tracked> g = std::move(h);
+        assert_int_equal(mem_pool_compact(pool), ALLOC_FAIL);
+        g.reset();
+        assert_int_equal(tracked::live, 0);
+    }
+    assert_int_equal(mem_pool_unpin(pool), ALLOC_FAIL);
+
+    assert_int_equal(mem_pool_compact(pool), ALLOC_OK);
+    assert_ptr_equal(a.data(), pool->mem);
+    for (size_t u=0; u<a.size(); ++u) assert_int_equal(a.data()[u], 'a');
+    a.reset();
+
+    mem_pool::Pool<mem_pool::Slab<16>> slabs(64 * 1024);
+    void *block = slabs.allocate();
+    assert_non_null(block);
+    assert_int_equal(mem_pool_compact(slabs.get()), ALLOC_FAIL);
+}
+
+
+/*****              main               *****/
+
+int main() {
+    const struct CMUnitTest tests[] = {
+            cmocka_unit_test_setup_teardown(test_pool_allocator_containers, pool_setup, pool_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_resource, pool_setup, pool_teardown),
+            cmocka_unit_test(test_pool_policy_templates),
+            cmocka_unit_test(test_pool_slab),
+            cmocka_unit_test_setup_teardown(test_pool_raii_handles, pool_setup, pool_teardown),
+            cmocka_unit_test_setup_teardown(test_pool_compaction_pins, pool_setup, pool_teardown),
+    };
+
+    return cmocka_run_group_tests_name("pool_cpp_test_suite", tests, NULL, NULL);
+}